@@ -24,6 +24,14 @@ static inline void w_mstatus(uint64 x)
     asm volatile("csrw mstatus, %0" : : "r"(x));
 }
 
+// 读取misa寄存器 (hart支持的指令集扩展)
+static inline uint64 r_misa()
+{
+    uint64 x;
+    asm volatile("csrr %0, misa" : "=r"(x));
+    return x;
+}
+
 // M-mode发生异常时，返回地址存在mepc寄存器
 // 写入mepc寄存器
 static inline void w_mepc(uint64 x)
@@ -268,3 +276,15 @@ static inline void sfence_vma()
 {
     asm volatile("sfence.vma zero, zero");
 }
+
+// 刷新TLB中属于某个ASID的全部表项 (不影响全局映射)
+static inline void sfence_vma_asid(uint64 asid)
+{
+    asm volatile("sfence.vma zero, %0" : : "r"(asid));
+}
+
+// 刷新TLB中属于某个ASID的一个虚拟地址的表项
+static inline void sfence_vma_va_asid(uint64 va, uint64 asid)
+{
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid));
+}
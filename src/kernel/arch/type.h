@@ -1,7 +1,8 @@
 #pragma once
 
-/* 基本类型定义 */
+/* 基本类型定义 (汇编文件也会包含这个头文件, 只使用其中的宏) */
 
+#ifndef __ASSEMBLER__
 typedef char int8;
 typedef short int16;
 typedef int int32;
@@ -21,11 +22,12 @@ typedef enum
 #ifndef NULL
 #define NULL ((void *)0)
 #endif
+#endif
 
 
 /* OS 全局变量 */
 
-#define NCPU 2 // 最大CPU数量
+#define NCPU 8 // 最大CPU数量 (实际数量启动时从设备树读出, 见 boot_info)
 
 
 /* RISC-V 架构常量与宏定义 */
@@ -36,6 +38,10 @@ typedef enum
 #define MSTATUS_MPP_S (1L << 11)
 #define MSTATUS_MPP_U (0L << 11)
 #define MSTATUS_MIE (1L << 3)
+#define MSTATUS_VS_INITIAL (1L << 9) // 向量单元状态: Initial (Off时执行向量指令会触发非法指令异常)
+
+/* Machine ISA Register (misa) */
+#define MISA_V (1L << ('V' - 'A')) // 支持向量扩展(RVV)
 
 /* Supervisor Status Register (sstatus) */
 #define SSTATUS_SPP (1L << 8)
@@ -43,6 +49,8 @@ typedef enum
 #define SSTATUS_UPIE (1L << 4)
 #define SSTATUS_SIE (1L << 1)
 #define SSTATUS_UIE (1L << 0)
+#define SSTATUS_VS (3L << 9) // 向量单元状态 (mstatus.VS的视图)
+#define SSTATUS_VS_INITIAL (1L << 9)
 
 /* Supervisor Interrupt Enable (sie) */
 #define SIE_SEIE (1L << 9) // S-mode 外设中断
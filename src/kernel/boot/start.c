@@ -5,10 +5,13 @@
 // 为每个 CPU 核心预留启动栈空间 (4KB per CPU)
 __attribute__((aligned(16))) uint8 CPU_stack[4096 * NCPU];
 
+// 设备树的物理地址, main 在初始化物理内存之前解析它
+uint64 boot_dtb;
+
 // 声明跳转目标
 extern void main();
 
-void start()
+void start(uint64 hartid, uint64 dtb)
 {
     // 1. 启动初期禁用分页，直接使用物理地址访问
     w_satp(0);
@@ -17,6 +20,8 @@ void start()
     // 这样后续在 S-mode 可以通过 r_tp() 获取当前核心 ID
     uint64 id = r_mhartid();
     w_tp(id);
+    if (id == 0)
+        boot_dtb = dtb;
 
     // 3. 配置 Trap 委托机制 (M-mode -> S-mode)
     // 将所有异常 (Exception) 委托给 S-mode 处理
@@ -42,6 +47,10 @@ void start()
     uint64 status_val = r_mstatus();
     status_val &= ~MSTATUS_MPP_MASK; // 清除 MPP 位
     status_val |= MSTATUS_MPP_S;     // 设置为 Supervisor 模式
+    // 支持向量扩展时把向量单元设为Initial, 只是告诉S-mode的mem_init可以使用它
+    // 之后内核平时和用户态都保持Off, 只在内核执行向量指令期间打开 (见 mem_op)
+    if (r_misa() & MISA_V)
+        status_val |= MSTATUS_VS_INITIAL;
     w_mstatus(status_val);
 
     // 7. 设置 mret 的返回地址 (mepc)
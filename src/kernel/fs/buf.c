@@ -1,8 +1,13 @@
 #include "mod.h"
 
-static buffer_node_t buf_cache[N_BUFFER];
+static buffer_node_t *buf_cache;   // buf_count个节点 (vmalloc)
+static uint32 buf_count;
 static buffer_node_t buf_head_active, buf_head_inactive;
-static spinlock_t lk_buf_cache;
+static buffer_node_t **buf_hash;   // 按块号索引的哈希表 (vmalloc), 避免未命中时遍历两条链表
+static uint32 buf_hash_size;       // 桶的数量 (2的幂)
+static spinlock_t lk_buf_cache;    // 保护两条链表和哈希表
+static uint32 buf_nr_pages;     // 持有物理页的buffer数量 (原子操作)
+static shrinker_t buffer_shrinker;
 
 /* 
 	将一个节点拿出来并插入
@@ -38,29 +43,74 @@ static void insert_node(buffer_node_t *node, bool insert_active, bool insert_nex
 	}
 }
 
+/*------------------------------ 哈希表 (调用者持有lk_buf_cache) ------------------------------*/
+
+#define BUF_HASH(block_num) ((block_num) & (buf_hash_size - 1))
+
+static buffer_node_t *hash_lookup(uint32 block_num)
+{
+	buffer_node_t *node = buf_hash[BUF_HASH(block_num)];
+	while (node != NULL && node->buf.block_num != block_num)
+		node = node->hash_next;
+	return node;
+}
+
+static void hash_insert(buffer_node_t *node)
+{
+	buffer_node_t **head = &buf_hash[BUF_HASH(node->buf.block_num)];
+	node->hash_next = *head;
+	*head = node;
+}
+
+static void hash_remove(buffer_node_t *node)
+{
+	buffer_node_t **pp = &buf_hash[BUF_HASH(node->buf.block_num)];
+	while (*pp != node)
+		pp = &(*pp)->hash_next;
+	*pp = node->hash_next;
+	node->hash_next = NULL;
+}
+
 /* 
 	buffer系统初始化：
 	1. 初始化全局的lk_buf_cache + buf_head_active + buf_head_inactive
-	2. 初始化buf_cache中的所有node, 并将他们放在不活跃链表中
+	2. 按内存大小分配buf_cache (每个物理页对应一个node), 初始化所有node并放在不活跃链表中
+	3. 分配按块号查找的哈希表 (开始时是空的)
 */
 void buffer_init()
 {
 	spinlock_init(&lk_buf_cache, "buffer_cache");
-    
+
+    buf_count = MIN(N_BUFFER, (boot_info.mem_end - KERNEL_BASE) / BLOCK_SIZE);
+    buf_cache = (buffer_node_t *)vmalloc((uint64)buf_count * sizeof(buffer_node_t));
+    if (buf_cache == NULL)
+        panic("buffer_init: no memory");
+
+    buf_hash_size = 1;
+    while ((buf_hash_size << BUF_HASH_SHIFT) < buf_count)
+        buf_hash_size <<= 1;
+    buf_hash = (buffer_node_t **)vmalloc((uint64)buf_hash_size * sizeof(buffer_node_t *));
+    if (buf_hash == NULL)
+        panic("buffer_init: no memory");
+
     // 初始化链表头
     buf_head_active.next = buf_head_active.prev = &buf_head_active;
     buf_head_inactive.next = buf_head_inactive.prev = &buf_head_inactive;
 
     // 初始化所有 buffer 节点并放入 inactive 链表
-    for (int i = 0; i < N_BUFFER; i++) {
+    for (uint32 i = 0; i < buf_count; i++) {
         buffer_node_t *node = &buf_cache[i];
         sleeplock_init(&node->buf.slk, "buffer_sleeplock");
         node->buf.data = NULL; // 初始时不分配物理页
         node->buf.ref = 0;
         node->buf.block_num = BLOCK_NUM_UNUSED;
+        node->hash_next = NULL;
         
         insert_node(node, false, true); // 插入 inactive 链表
     }
+
+    // 缓存可以占满空闲内存, 内存紧张时由回收路径释放
+    pmem_register_shrinker(&buffer_shrinker);
 }
 
 /* 磁盘读取: block -> buf */
@@ -75,58 +125,61 @@ void buffer_write(buffer_t *buf)
 	virtio_disk_rw(buf, true);
 }
 
+/*
+	buffer的物理页被mmap映射到用户页表时引用数大于1 (见inode_map_page)
+	这样的buffer即使在非活跃链表中也不能复用或者释放物理页
+*/
+static bool buffer_mapped(buffer_t *buf)
+{
+	return buf->data != NULL && pmem_page((uint64)buf->data)->ref > 1;
+}
+
 /* 从buf_cache中获取一个buf */
 buffer_t* buffer_get(uint32 block_num)
 {
 	spinlock_acquire(&lk_buf_cache);
 
-    // 1. 在活跃链表中查找
-    buffer_node_t *node = buf_head_active.next;
-    while (node != &buf_head_active) {
-        if (node->buf.block_num == block_num) {
-            node->buf.ref++;
-            spinlock_release(&lk_buf_cache);
-            sleeplock_acquire(&node->buf.slk);
-            return &node->buf;
-        }
-        node = node->next;
-    }
-
-    // 2. 在非活跃链表中查找 (缓存复活)
-    node = buf_head_inactive.next;
-    while (node != &buf_head_inactive) {
-        if (node->buf.block_num == block_num) {
-            node->buf.ref = 1;
+    // 1. 通过哈希表查找: ref > 0 的在活跃链表中, 否则在非活跃链表中 (缓存复活)
+    buffer_node_t *node = hash_lookup(block_num);
+    if (node != NULL) {
+        if (node->buf.ref++ == 0)
             insert_node(node, true, true); // 移入 active
-            spinlock_release(&lk_buf_cache);
-            sleeplock_acquire(&node->buf.slk);
-            return &node->buf;
-        }
-        node = node->next;
+        spinlock_release(&lk_buf_cache);
+        sleeplock_acquire(&node->buf.slk);
+        return &node->buf;
     }
 
-    // 3. 缓存未命中，从非活跃链表分配一个 (LRU Victim)
-    // 这里简单地取 inactive 的第一个节点
+    // 2. 缓存未命中，从非活跃链表分配一个 (LRU Victim)
+    // 这里简单地取 inactive 中第一个没有被映射的节点
     node = buf_head_inactive.next;
+    while (node != &buf_head_inactive && buffer_mapped(&node->buf))
+        node = node->next;
     if (node == &buf_head_inactive) {
         panic("buffer_get: no free buffers");
     }
 
-    // 初始化节点信息
+    // 初始化节点信息, 从旧块号的哈希桶移到新块号的
+    if (node->buf.block_num != BLOCK_NUM_UNUSED)
+        hash_remove(node);
     node->buf.block_num = block_num;
     node->buf.ref = 1;
-    
-    // 如果该 buffer 还没有分配物理页，则分配
-    if (node->buf.data == NULL) {
-        node->buf.data = (uint8 *)pmem_alloc(false);
-        if (!node->buf.data) panic("buffer_get: pmem alloc failed");
-    }
+    hash_insert(node);
 
     insert_node(node, true, true); // 移入 active
     spinlock_release(&lk_buf_cache);
 
     // 获取睡眠锁并从磁盘读取数据
     sleeplock_acquire(&node->buf.slk);
+
+    // 如果该 buffer 还没有分配物理页，则分配
+    // 分配可能触发回收并进入buffer_shrink, 所以不能持有lk_buf_cache
+    // 节点已经在活跃链表中, shrinker不会碰它
+    if (node->buf.data == NULL) {
+        // 马上会从磁盘读入数据, 不需要清零
+        node->buf.data = (uint8 *)pmem_alloc_flags(false, 0);
+        if (!node->buf.data) panic("buffer_get: pmem alloc failed");
+        __sync_fetch_and_add(&buf_nr_pages, 1);
+    }
     buffer_read(&node->buf);
 
     return &node->buf;
@@ -152,6 +205,7 @@ void buffer_put(buffer_t *buf)
 
 /*
 	从后向前遍历非活跃链表, 尝试释放buffer_count个buffer持有的物理内存(data)
+	buffer_put把节点插在非活跃链表头部, 所以尾部是最久没有使用的
 	返回成功释放资源的buffer数量
 */
 uint32 buffer_freemem(uint32 buffer_count)
@@ -159,30 +213,57 @@ uint32 buffer_freemem(uint32 buffer_count)
 	uint32 freed = 0;
     spinlock_acquire(&lk_buf_cache);
 
-    buffer_node_t *node = buf_head_inactive.next;
+    buffer_node_t *node = buf_head_inactive.prev;
     while (node != &buf_head_inactive && freed < buffer_count) {
-        buffer_node_t *next = node->next;
+        buffer_node_t *prev = node->prev;
         
-        if (node->buf.data != NULL) {
+        if (node->buf.data != NULL && !buffer_mapped(&node->buf)) {
             pmem_free((uint64)node->buf.data, false);
             node->buf.data = NULL;
+            if (node->buf.block_num != BLOCK_NUM_UNUSED)
+                hash_remove(node);
             node->buf.block_num = BLOCK_NUM_UNUSED; // 标记为无效
+            __sync_fetch_and_sub(&buf_nr_pages, 1);
             freed++;
         }
         
-        node = next;
-		}
+        node = prev;
+    }
 
     spinlock_release(&lk_buf_cache);
     return freed;
 }
 
+/*------------------------------ shrinker ------------------------------*/
+
+/* 持有物理页的buffer数量 (包括活跃的和被映射的, 只是一个上限) */
+static uint32 buffer_shrink_count()
+{
+	return buf_nr_pages;
+}
+
+static uint32 buffer_shrink(uint32 nr)
+{
+	// 分配来自本CPU持有lk_buf_cache的临界区
+	if (spinlock_holding(&lk_buf_cache))
+		return 0;
+	return buffer_freemem(nr);
+}
+
+/* buffer的物理页来自用户池 */
+static shrinker_t buffer_shrinker = {
+	.name = "buffer_cache",
+	.in_kernel = false,
+	.count = buffer_shrink_count,
+	.scan = buffer_shrink,
+};
+
 /* 输出buffer_cache的信息 (for test) */
 void buffer_print_info()
 {
 	buffer_node_t *node;
 
-	assert(N_BUFFER == N_BUFFER_TEST, "buffer_print_info: invalid N_BUFFER");
+	assert(buf_count == N_BUFFER_TEST, "buffer_print_info: invalid buffer count");
 
 	spinlock_acquire(&lk_buf_cache);
 
@@ -19,7 +19,7 @@ static char* strcpy(char *s, const char *t) {
 // 手动实现 either_copy_to
 static int either_copy_to(bool is_user, uint64 dst, void *src, uint32 len) {
     if (is_user) {
-        uvm_copyout(myproc()->pgtbl, dst, (uint64)src, len);
+        return uvm_copyout(myproc()->pgtbl, dst, (uint64)src, len);
     } else {
         memmove((void*)dst, src, len);
     }
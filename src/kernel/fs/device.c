@@ -20,7 +20,7 @@
 // 2. 实现辅助拷贝函数 (either_copy)
 static int either_copy_to(bool is_user, uint64 dst, void *src, uint32 len) {
     if (is_user) {
-        uvm_copyout(myproc()->pgtbl, dst, (uint64)src, len);
+        return uvm_copyout(myproc()->pgtbl, dst, (uint64)src, len);
     } else {
         memmove((void*)dst, src, len);
     }
@@ -29,7 +29,7 @@ static int either_copy_to(bool is_user, uint64 dst, void *src, uint32 len) {
 
 static int either_copy_from(bool is_user, void *dst, uint64 src, uint32 len) {
     if (is_user) {
-        uvm_copyin(myproc()->pgtbl, (uint64)dst, src, len);
+        return uvm_copyin(myproc()->pgtbl, (uint64)dst, src, len);
     } else {
         memmove(dst, (void*)src, len);
     }
@@ -58,14 +58,11 @@ static uint32 device_stderr_write(uint32 len, uint64 src, bool is_user_src)
     return cons_write(len, src, is_user_src);
 }
 
-/* 无限0流 (/dev/zero) */
+/* 无限0流 (/dev/zero): 直接从共享零页拷贝 */
 static uint32 device_zero_read(uint32 len, uint64 dst, bool is_user_dst)
 {
     uint32 write_len = 0, cut_len = 0;
-    // 分配一个全0的物理页作为源
-    uint64 src = (uint64)pmem_alloc(true); 
-    if (!src) return 0;
-    memset((void*)src, 0, PGSIZE);
+    uint64 src = pmem_zero_page();
 
     while (write_len < len)
     {
@@ -79,7 +76,6 @@ static uint32 device_zero_read(uint32 len, uint64 dst, bool is_user_dst)
         write_len += cut_len;
     }
 
-    pmem_free(src, true);
     return write_len;
 }
 
@@ -113,7 +109,7 @@ static uint32 device_gpt0_write(uint32 len, uint64 src, bool is_user_src)
         printf("Your procid is %d and name is %s.\n", p->pid, p->name);
     } else if (strncmp(tmp, "How many free memory left", copy_len) == 0) {
         uint32 kernel_free_pages, user_free_pages;
-        pmem_stat(&kernel_free_pages, &user_free_pages);
+        pmem_stat(&kernel_free_pages, &user_free_pages, NULL);
         printf("We have %d free pages in kernel space, %d free pages in user space!\n",
             kernel_free_pages, user_free_pages);
     } else if (strncmp(tmp, "Good job", copy_len) == 0) {
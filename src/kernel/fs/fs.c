@@ -11,8 +11,8 @@
 #define INODE_DIRECTORY INODE_TYPE_DIR
 #define INODE_DEVICE    INODE_TYPE_DEVICE
 
-// 全局文件表：存放所有打开的文件对象
-file_t file_table[N_FILE];
+// 全局文件表：打开的文件对象由 file_cache 分配, lk_file_table 保护它们的引用计数
+static kmem_cache_t *file_cache;
 spinlock_t lk_file_table;
 
 // [修复] 定义超级块变量
@@ -21,7 +21,7 @@ super_block_t sb;
 // [修复] 实现辅助拷贝函数 (从 device.c 移植或包含)
 static int either_copy_to(bool is_user, uint64 dst, void *src, uint32 len) {
     if (is_user) {
-        uvm_copyout(myproc()->pgtbl, dst, (uint64)src, len);
+        return uvm_copyout(myproc()->pgtbl, dst, (uint64)src, len);
     } else {
         memmove((void*)dst, src, len);
     }
@@ -34,11 +34,7 @@ static int either_copy_to(bool is_user, uint64 dst, void *src, uint32 len) {
 void file_init() {
     // [修复] 函数名 spinlock_init
     spinlock_init(&lk_file_table, "file_table");
-    spinlock_acquire(&lk_file_table);
-    for (int i = 0; i < N_FILE; i++) {
-        file_table[i].ref = 0;
-    }
-    spinlock_release(&lk_file_table);
+    file_cache = kmem_cache_create("file", sizeof(file_t));
 }
 
 /**
@@ -69,23 +65,16 @@ void fs_init() {
 }
 
 /**
- * 从全局文件表中分配一个空闲的 file 结构
+ * 分配一个新的 file 结构
  */
 file_t* file_alloc() {
-    spinlock_acquire(&lk_file_table);
-    for (int i = 0; i < N_FILE; i++) {
-        if (file_table[i].ref == 0) {
-            file_table[i].ref = 1;
-            file_table[i].offset = 0;
-            file_table[i].readable = false;
-            file_table[i].writable = false;
-            file_table[i].ip = NULL;
-            spinlock_release(&lk_file_table);
-            return &file_table[i];
-        }
-    }
-    spinlock_release(&lk_file_table);
-    return NULL;
+    file_t *f = kmem_cache_alloc(file_cache);
+    f->ref = 1;
+    f->offset = 0;
+    f->readable = false;
+    f->writable = false;
+    f->ip = NULL;
+    return f;
 }
 
 /**
@@ -114,6 +103,7 @@ void file_close(file_t *f) {
     f->ref = 0;
     f->ip = NULL;
     spinlock_release(&lk_file_table);
+    kmem_cache_free(file_cache, f);
 
     if (ip) {
         inode_put(ip);
@@ -173,6 +163,53 @@ file_t* file_open(char *path, uint32 open_mode) {
     return f;
 }
 
+/*
+ * 用户缓冲区的读写经过一页大小的内核缓冲区:
+ * 拷贝用户数据可能触发缺页, 缺页处理可能要锁住同一个inode(文件映射)或睡眠等待磁盘,
+ * 所以持有 ip->slk 和块缓冲区的睡眠锁时不能访问用户地址 (见 uvm.c user_page)
+ */
+#define FILE_BOUNCE_SIZE PGSIZE
+
+static uint32 file_read_user(file_t* f, uint32 len, uint64 dst) {
+    char *bounce = kmalloc(FILE_BOUNCE_SIZE);
+    if (bounce == NULL) return 0;
+    uint32 bytes = 0;
+    while (bytes < len) {
+        sleeplock_acquire(&f->ip->slk);
+        uint32 n = inode_read_data(f->ip, f->offset, MIN(len - bytes, FILE_BOUNCE_SIZE), bounce, false);
+        f->offset += n;
+        sleeplock_release(&f->ip->slk);
+
+        if (n == 0 || uvm_copyout(myproc()->pgtbl, dst + bytes, (uint64)bounce, n) < 0)
+            break;
+        bytes += n;
+    }
+    kfree(bounce);
+    return bytes;
+}
+
+static uint32 file_write_user(file_t* f, uint32 len, uint64 src) {
+    char *bounce = kmalloc(FILE_BOUNCE_SIZE);
+    if (bounce == NULL) return 0;
+    uint32 bytes = 0;
+    while (bytes < len) {
+        uint32 want = MIN(len - bytes, FILE_BOUNCE_SIZE);
+        if (uvm_copyin(myproc()->pgtbl, (uint64)bounce, src + bytes, want) < 0)
+            break;
+
+        sleeplock_acquire(&f->ip->slk);
+        uint32 n = inode_write_data(f->ip, f->offset, want, bounce, false);
+        f->offset += n;
+        sleeplock_release(&f->ip->slk);
+
+        bytes += n;
+        if (n < want)
+            break;
+    }
+    kfree(bounce);
+    return bytes;
+}
+
 /**
  * 读取文件
  */
@@ -183,6 +220,8 @@ uint32 file_read(file_t* f, uint32 len, uint64 dst, bool is_user_dst) {
     if (f->ip->disk_info.type == INODE_DEVICE) {
         // [修复] device_read_data 已声明
         bytes = device_read_data(f->ip->disk_info.major, len, dst, is_user_dst);
+    } else if (is_user_dst) {
+        bytes = file_read_user(f, len, dst);
     } else {
         sleeplock_acquire(&f->ip->slk);
         // [修复] 使用 inode_read_data，并调整参数顺序 (offset, len, dst)
@@ -204,6 +243,8 @@ uint32 file_write(file_t* f, uint32 len, uint64 src, bool is_user_src) {
     uint32 bytes = 0;
     if (f->ip->disk_info.type == INODE_DEVICE) {
         bytes = device_write_data(f->ip->disk_info.major, len, src, is_user_src);
+    } else if (is_user_src) {
+        bytes = file_write_user(f, len, src);
     } else {
         sleeplock_acquire(&f->ip->slk);
         // [修复] 使用 inode_write_data，并调整参数顺序 (offset, len, src)
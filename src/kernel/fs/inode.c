@@ -2,18 +2,19 @@
 
 extern super_block_t sb;
 
-/* 内存中的inode资源集合 */
-static inode_t inode_cache[N_INODE];
+/* 内存中的inode资源集合 (由slab分配的inode组成的链表) */
+static inode_t *inode_cache;
+static uint32 nr_inode;
 static spinlock_t lk_inode_cache;
+static kmem_cache_t *inode_kcache;
+static shrinker_t inode_shrinker;
 
 /* inode_cache初始化 */
 void inode_init()
 {
     spinlock_init(&lk_inode_cache, "inode_cache");
-    // 初始化所有 inode 的睡眠锁
-    for(int i = 0; i < N_INODE; i++){
-        sleeplock_init(&inode_cache[i].slk, "inode");
-    }
+    inode_kcache = kmem_cache_create("inode", sizeof(inode_t));
+    pmem_register_shrinker(&inode_shrinker);
 } 
 
 /*--------------------关于inode->index的增删查操作-----------------*/
@@ -216,6 +217,38 @@ static uint32 locate_or_add_block(uint32 *inode_index, uint32 logical_block_num)
     return -1; // 超出最大文件大小
 }
 
+/* 辅助: 读出索引块index_blk中第idx项 (index_blk为0表示索引块不存在, 结果也是0) */
+static uint32 index_entry(uint32 index_blk, uint32 idx)
+{
+    if (index_blk == 0)
+        return 0;
+    buffer_t *buf = buffer_get(index_blk);
+    uint32 entry = ((uint32 *)buf->data)[idx];
+    buffer_put(buf);
+    return entry;
+}
+
+/*
+	只查找inode第logical_block_num个block的物理序号, 不分配
+	该逻辑块不存在(文件空洞)或超出最大文件大小时返回0
+*/
+static uint32 locate_block(uint32 *inode_index, uint32 logical_block_num)
+{
+    if (logical_block_num < INODE_INDEX_1)
+        return inode_index[logical_block_num];
+    logical_block_num -= INODE_INDEX_1;
+
+    if (logical_block_num < 2 * 1024)
+        return index_entry(inode_index[INODE_INDEX_1 + logical_block_num / 1024], logical_block_num % 1024);
+    logical_block_num -= 2 * 1024;
+
+    if (logical_block_num < 1024 * 1024) {
+        uint32 l1_block = index_entry(inode_index[INODE_INDEX_2], logical_block_num / 1024);
+        return index_entry(l1_block, logical_block_num % 1024);
+    }
+    return 0;
+}
+
 /*---------------------关于inode的管理: get dup lock unlock put----------------------*/
 
 /* 磁盘里的inode <-> 内存里的inode
@@ -255,10 +288,10 @@ inode_t *inode_get(uint32 inode_num)
     spinlock_acquire(&lk_inode_cache);
 
     // 1. 搜索缓存
-    for(ip = &inode_cache[0]; ip < &inode_cache[N_INODE]; ip++){
+    for(ip = inode_cache; ip != NULL; ip = ip->next){
         // 修改：即使 ref==0，只要 inode_num 匹配且 valid_info 有效，也可以复用
         // 注意：这里我们简单复用 slot，避免同一个 inode_num 占据多个 slot
-        if(ip->inode_num == inode_num && ip->valid_info){
+        if(ip->inode_num == inode_num && (ip->valid_info || ip->ref > 0)){
             ip->ref++;
             spinlock_release(&lk_inode_cache);
             return ip;
@@ -267,9 +300,15 @@ inode_t *inode_get(uint32 inode_num)
             empty_ip = ip;
     }
 
-    // 2. 缓存未命中，分配新的 cache slot
-    if(empty_ip == NULL)
-        panic("inode_get: no inodes");
+    // 2. 缓存未命中: 没达到目标数量或者没有空闲slot时申请新的inode, 否则复用空闲slot
+    if(empty_ip == NULL || nr_inode < N_INODE){
+        empty_ip = kmem_cache_alloc(inode_kcache);
+        memset(empty_ip, 0, sizeof(inode_t));
+        sleeplock_init(&empty_ip->slk, "inode");
+        empty_ip->next = inode_cache;
+        inode_cache = empty_ip;
+        nr_inode++;
+    }
 
     ip = empty_ip;
     ip->inode_num = inode_num;
@@ -376,9 +415,61 @@ void inode_put(inode_t* ip)
     }
 
     ip->ref--;
+
+    // 超过目标数量时不再缓存没人使用的inode
+    if(ip->ref == 0 && nr_inode > N_INODE){
+        inode_t **pp = &inode_cache;
+        while(*pp != ip)
+            pp = &(*pp)->next;
+        *pp = ip->next;
+        nr_inode--;
+        kmem_cache_free(inode_kcache, ip);
+    }
     spinlock_release(&lk_inode_cache);
 }
 
+/*
+	shrinker: 内存紧张时释放没人使用的inode (即使没有超过N_INODE)
+	inode_t来自slab, 整个slab空闲时页面才会回到内核池
+*/
+static uint32 inode_shrink_count()
+{
+    return nr_inode;
+}
+
+static uint32 inode_shrink(uint32 nr)
+{
+    uint32 freed = 0;
+
+    // inode_get在持有lk_inode_cache时分配inode_t
+    if(spinlock_holding(&lk_inode_cache))
+        return 0;
+
+    spinlock_acquire(&lk_inode_cache);
+    inode_t **pp = &inode_cache;
+    while(*pp != NULL && freed < nr){
+        inode_t *ip = *pp;
+        if(ip->ref == 0){
+            *pp = ip->next;
+            nr_inode--;
+            kmem_cache_free(inode_kcache, ip);
+            freed++;
+        } else {
+            pp = &ip->next;
+        }
+    }
+    spinlock_release(&lk_inode_cache);
+
+    return freed;
+}
+
+static shrinker_t inode_shrinker = {
+    .name = "inode_cache",
+    .in_kernel = true,
+    .count = inode_shrink_count,
+    .scan = inode_shrink,
+};
+
 /*----------------------基于inode的数据读写操作--------------------*/
 
 /*
@@ -413,11 +504,11 @@ uint32 inode_read_data(inode_t *ip, uint32 offset, uint32 len, void *dst, bool i
         // 3. 读取数据
         buffer_t *buf = buffer_get(phys_blk);
         if(is_user_dst){
-            // 这是一个虚构的 copyout，你需要确保 utils.c 或其他地方有 memcpy/copyout
-            // 这里假设 dst 是内核地址或者可以直接写
-            // 注意：如果是用户态地址，通常需要 copyout。Lab中简化处理可能直接 memcpy
-            // 假设 Lab8 环境是简单的内核态测试，直接 memcpy
-            memcpy((char*)dst + total_read, buf->data + off_in_blk, n);
+            // 用户地址在内核页表里没有映射, 必须通过copyout
+            if(uvm_copyout(myproc()->pgtbl, (uint64)dst + total_read, (uint64)buf->data + off_in_blk, n) < 0){
+                buffer_put(buf);
+                break;
+            }
         } else {
             memcpy((char*)dst + total_read, buf->data + off_in_blk, n);
         }
@@ -451,7 +542,14 @@ uint32 inode_write_data(inode_t *ip, uint32 offset, uint32 len, void *src, bool
         if(phys_blk == -1) break; // 磁盘满
 
         buffer_t *buf = buffer_get(phys_blk);
-        memcpy(buf->data + off_in_blk, (char*)src + total_written, n);
+        if(is_user_src){
+            if(uvm_copyin(myproc()->pgtbl, (uint64)buf->data + off_in_blk, (uint64)src + total_written, n) < 0){
+                buffer_put(buf);
+                break;
+            }
+        } else {
+            memcpy(buf->data + off_in_blk, (char*)src + total_written, n);
+        }
         buffer_write(buf); // 标记 dirty 并写回
         buffer_put(buf);
 
@@ -468,6 +566,59 @@ uint32 inode_write_data(inode_t *ip, uint32 offset, uint32 len, void *src, bool
     return total_written;
 }
 
+/*----------------------文件映射 (mmap)--------------------*/
+
+/*
+	获取文件中offset(PGSIZE对齐)处数据块所在的缓冲区物理页, 用于映射到用户页表
+	返回前增加物理页的引用数, 调用者解除映射时通过pmem_free归还
+	alloc为false时(只读或私有映射)不分配磁盘块: 文件空洞返回共享零页
+	只有数据文件可以映射, offset不能超过文件大小, 失败返回0
+*/
+uint64 inode_map_page(inode_t *ip, uint32 offset, bool alloc)
+{
+    uint64 pa = 0;
+
+    inode_lock(ip);
+    if (ip->disk_info.type == INODE_TYPE_DATA && offset < ip->disk_info.size) {
+        uint32 phys_blk;
+        if (alloc) {
+            phys_blk = locate_or_add_block(ip->disk_info.index, offset / BLOCK_SIZE);
+        } else if ((phys_blk = locate_block(ip->disk_info.index, offset / BLOCK_SIZE)) == 0) {
+            pa = pmem_zero_page();
+            pmem_page_get(pa);
+            phys_blk = -1;
+        }
+        if (phys_blk != -1) {
+            buffer_t *buf = buffer_get(phys_blk);
+            pa = (uint64)buf->data;
+            pmem_page_get(pa);
+            buffer_put(buf);
+        }
+    }
+    inode_unlock(ip);
+
+    return pa;
+}
+
+/*
+	把共享映射修改过的一页(文件偏移offset)写回磁盘
+	映射的物理页就是缓冲区的data, 只需要让缓冲区执行一次写入
+*/
+void inode_sync_page(inode_t *ip, uint32 offset)
+{
+    inode_lock(ip);
+    if (offset < ip->disk_info.size) {
+        // 映射时已经分配了磁盘块, 这里只查找
+        uint32 phys_blk = locate_block(ip->disk_info.index, offset / BLOCK_SIZE);
+        if (phys_blk != 0) {
+            buffer_t *buf = buffer_get(phys_blk);
+            buffer_write(buf);
+            buffer_put(buf);
+        }
+    }
+    inode_unlock(ip);
+}
+
 /* --- Append to src/kernel/fs/inode.c --- */
 
 static char *inode_type_list[] = {"DATA", "DIR", "DEVICE"};
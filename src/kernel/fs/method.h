@@ -32,6 +32,8 @@ void inode_put(inode_t* ip);
 void inode_delete(inode_t *ip);
 uint32 inode_read_data(inode_t *ip, uint32 offset, uint32 len, void *dst, bool is_user_dst);
 uint32 inode_write_data(inode_t *ip, uint32 offset, uint32 len, void *src, bool is_user_src);
+uint64 inode_map_page(inode_t *ip, uint32 offset, bool alloc);
+void inode_sync_page(inode_t *ip, uint32 offset);
 void inode_print(inode_t *ip, char* name);
 
 /* dentry.c: 关于目录项和文件路径 */
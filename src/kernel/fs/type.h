@@ -37,9 +37,8 @@ typedef struct used_area {
 } used_area_t;
 
 typedef struct disk {
-    // 驱动需要8KB的连续空间, 不适合用pmem_alloc来申请
-    // 所以直接定义在这里
-    char pages[2 * PGSIZE];
+    // 驱动需要8KB物理连续的空间, 由伙伴系统分配一个1阶的块
+    char *pages;
     
     vring_desc_t *desc;
     used_area_t *used;
@@ -88,9 +87,10 @@ typedef struct disk {
 /*-------------------关于块缓冲区--------------------*/
 
 #define BLOCK_SIZE 4096              // 基本管理单位的大小
-#define N_BUFFER_TEST 8              // 测试时的N_BUFFER取值
-#define N_BUFFER (32 * 512)          // 最多可以用32MB内存空间(25%)作为Block缓冲区
+#define N_BUFFER_TEST 8              // 测试时的buffer数量
+#define N_BUFFER (512 * 1024)        // buffer数量的上限; 启动时按内存大小确定, 最多可以用满内存作为Block缓冲区 (内存紧张时由shrinker回收)
 #define BLOCK_NUM_UNUSED 0xFFFFFFFF  // 未使用的Buffer需要将block_num设为这个值
+#define BUF_HASH_SHIFT 2             // 按块号查找buffer的哈希表: 平均每个桶 2^BUF_HASH_SHIFT 个buffer
 
 /* 以Block为单位在内存和磁盘间传递数据 */
 typedef struct buffer {
@@ -111,6 +111,7 @@ typedef struct buffer_node {
     buffer_t buf;                     // 资源
     struct buffer_node *next;         // 链接
     struct buffer_node *prev;         // 链接
+    struct buffer_node *hash_next;    // 同一个哈希桶中的下一个节点 (block_num有效的节点才在哈希表中)
 } buffer_node_t;
 
 /*-------------------关于文件系统--------------------*/
@@ -133,6 +134,8 @@ typedef struct super_block {
 	unsigned int data_bitmap_blocks;         // data_bitmap区域的块数量
 	unsigned int data_firstblock;            // data区域的起始块号
     unsigned int data_blocks;                // data区域的块数量
+    unsigned int swap_firstblock;            // 交换区的起始块号 (紧跟在data区域之后)
+    unsigned int swap_blocks;                // 交换区的块数量 (0表示没有交换区)
 } super_block_t;
 
 /* type的可能取值 */
@@ -166,7 +169,7 @@ typedef struct inode_disk {
 } inode_disk_t;
 
 #define ROOT_INODE  0                 // 根节点的序号
-#define N_INODE     64                // 内存中最多存在的inode数量
+#define N_INODE     64                // 内存中inode缓存的目标数量 (超过后优先复用, 引用归零即释放)
 
 /* 内存里的索引节点 */
 typedef struct inode {
@@ -175,6 +178,7 @@ typedef struct inode {
     uint32 inode_num;                 // inode序号 (slk保护)
     uint32 ref;                       // 引用数 (lk_inode_cache保护)
     sleeplock_t slk;                  // 睡眠锁
+    struct inode *next;               // inode_cache链表 (lk_inode_cache保护)
 } inode_t;
 
 #define MAXLEN_FILENAME 60            // 文件名的最大长度
@@ -224,8 +228,6 @@ typedef struct file {
     uint32 ref;         // 引用数 (lk_file_table保护)
 } file_t;
 
-#define N_FILE 128      // file_table中file的数量
-
 /* 文件状态结构体 */
 typedef struct file_stat {
     uint16 type;        // inode_disk->type
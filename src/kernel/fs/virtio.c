@@ -51,7 +51,11 @@ void virtio_disk_init()
     if (max < VIRTIO_NUM)
         panic("virtio disk max queue too short");
     *R(VIRTIO_MMIO_QUEUE_NUM) = VIRTIO_NUM;
-    memset(disk.pages, 0, sizeof(disk.pages));
+    if (disk.pages == NULL)
+        disk.pages = pmem_alloc_pages(1, true);
+    if (disk.pages == NULL)
+        panic("virtio_disk_init: no contiguous pages");
+    memset(disk.pages, 0, 2 * PGSIZE);
     *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> 12;
 
     // desc = pages -- num * VRingDesc
@@ -31,22 +31,24 @@ uint32 cons_write(uint32 len, uint64 src, bool is_user_src)
 	uint32 write_len = 0, cut_len;
 	proc_t *p = myproc();
 
-	spinlock_acquire(&cons.lk);
+	// 用户数据在持锁之前拷贝到tmp: 拷贝可能触发缺页而睡眠, 不能持有cons.lk
 	while (write_len < len)
 	{
 		cut_len = MIN(len-write_len, sizeof(tmp));
-		if (is_user_src)
-			uvm_copyin(p->pgtbl, (uint64)tmp, src, cut_len);
-		else
+		if (is_user_src) {
+			if (uvm_copyin(p->pgtbl, (uint64)tmp, src, cut_len) < 0)
+				break;
+		} else
 			memmove(tmp, (void*)src, cut_len);
 
+		spinlock_acquire(&cons.lk);
 		for (uint32 i = 0; i < cut_len; i++)
 			cons_putc(tmp[i]);
+		spinlock_release(&cons.lk);
 		
 		src += cut_len;
 		write_len += cut_len;
 	}
-	spinlock_release(&cons.lk);
 
 	return write_len;
 }
@@ -66,9 +68,14 @@ uint32 cons_read(uint32 len, uint64 dst, bool is_user_dst)
 		
 		c = cons.buf[cons.read_idx++ % CONSOLE_INPUT_BUF];
 
-		if (is_user_dst)
-			uvm_copyout(p->pgtbl, dst, (uint64)&c, 1);
-		else
+		// 拷贝给用户可能触发缺页而睡眠, 先放开cons.lk
+		if (is_user_dst) {
+			spinlock_release(&cons.lk);
+			int ret = uvm_copyout(p->pgtbl, dst, (uint64)&c, 1);
+			spinlock_acquire(&cons.lk);
+			if (ret < 0)
+				break;
+		} else
 			memmove((void*)dst, &c, 1);
 		
 		dst++;
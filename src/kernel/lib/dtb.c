@@ -0,0 +1,114 @@
+#include "mod.h"
+
+// 设备树的解析 (格式见 type.h), 只在启动时由cpu0调用一次
+
+boot_info_t boot_info;
+
+// 读取大端序的32位数 (设备树中的数都是大端序)
+static uint32 be32(const void *p)
+{
+    const uint8 *b = (const uint8 *)p;
+    return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// 读取 cells 个32位单元组成的数
+static uint64 read_cells(const uint8 *p, uint32 cells)
+{
+    uint64 v = 0;
+    for (uint32 i = 0; i < cells; i++)
+        v = (v << 32) | be32(p + 4 * i);
+    return v;
+}
+
+// 节点名是否为 name 或者 name@单元地址
+static bool node_is(const char *node, const char *name)
+{
+    int n = strlen(name);
+    return strncmp(node, name, n) == 0 && (node[n] == '\0' || node[n] == '@');
+}
+
+static bool str_is(const char *s, const char *name)
+{
+    return strncmp(s, name, strlen(name) + 1) == 0;
+}
+
+/*
+ * 从设备树中读出内存范围和hart数量, 必须在初始化物理内存之前调用
+ * - 内存取 /memory 节点中从KERNEL_BASE开始的那一段, 结束地址限制在vmalloc区域之下
+ * - hart数量是 /cpus 下 cpu@ 节点的个数, 超过NCPU的部分不使用
+ * 设备树无效时保留默认值
+ */
+void dtb_init(uint64 dtb)
+{
+    boot_info.ncpu = NCPU;
+    boot_info.mem_end = (uint64)ALLOC_END;
+
+    const fdt_header_t *h = (const fdt_header_t *)dtb;
+    if (dtb == 0 || dtb % 4 != 0 || be32(&h->magic) != FDT_MAGIC) {
+        printf("dtb: not found, assume %d harts and %d MB\n",
+               NCPU, (int)((boot_info.mem_end - KERNEL_BASE) >> 20));
+        return;
+    }
+
+    const uint8 *p = (const uint8 *)dtb + be32(&h->off_dt_struct);
+    const uint8 *end = p + be32(&h->size_dt_struct);
+    const char *strings = (const char *)dtb + be32(&h->off_dt_strings);
+
+    uint32 addr_cells = 2, size_cells = 1; // 根节点没有给出时的默认值
+    uint32 ncpu = 0;
+    uint64 mem_end = 0;
+    int depth = 0;                         // 当前打开的节点层数, 根节点的属性在第1层
+    bool in_memory = false, in_cpus = false;
+
+    while (p < end) {
+        uint32 token = be32(p);
+        p += 4;
+
+        if (token == FDT_BEGIN_NODE) {
+            const char *name = (const char *)p;
+            p += ALIGN_UP(strlen(name) + 1, 4);
+            depth++;
+            if (depth == 2) {
+                in_memory = node_is(name, "memory");
+                in_cpus = node_is(name, "cpus");
+            } else if (depth == 3 && in_cpus && node_is(name, "cpu")) {
+                ncpu++;
+            }
+        } else if (token == FDT_END_NODE) {
+            if (--depth == 1)
+                in_memory = in_cpus = false;
+        } else if (token == FDT_PROP) {
+            uint32 len = be32(p);
+            const char *name = strings + be32(p + 4);
+            const uint8 *val = p + 8;
+            p += 8 + ALIGN_UP(len, 4);
+
+            if (depth == 1 && str_is(name, "#address-cells")) {
+                addr_cells = be32(val);
+            } else if (depth == 1 && str_is(name, "#size-cells")) {
+                size_cells = be32(val);
+            } else if (depth == 2 && in_memory && str_is(name, "reg") && addr_cells <= 2 && size_cells <= 2) {
+                uint32 entry = 4 * (addr_cells + size_cells);
+                for (uint32 off = 0; off + entry <= len; off += entry) {
+                    uint64 base = read_cells(val + off, addr_cells);
+                    uint64 size = read_cells(val + off + 4 * addr_cells, size_cells);
+                    if (base == KERNEL_BASE)
+                        mem_end = base + size;
+                }
+            }
+        } else if (token == FDT_END) {
+            break;
+        } else if (token != FDT_NOP) {
+            printf("dtb: bad token %d, stop parsing\n", token);
+            break;
+        }
+    }
+
+    if (ncpu > NCPU)
+        printf("dtb: %d harts, only %d are used\n", ncpu, NCPU);
+    if (ncpu > 0)
+        boot_info.ncpu = MIN(ncpu, NCPU);
+    if (mem_end > (uint64)ALLOC_BEGIN)
+        boot_info.mem_end = MIN(ALIGN_DOWN(mem_end, PGSIZE), VMALLOC_BASE);
+    printf("dtb: %d harts, %d MB memory\n", boot_info.ncpu, (int)((boot_info.mem_end - KERNEL_BASE) >> 20));
+}
@@ -0,0 +1,170 @@
+#include "mod.h"
+
+// LZ4块格式的压缩与解压 (格式见 type.h)
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5   // 最后5个字节总是字面量
+#define LZ4_MFLIMIT       12  // 最后12个字节内不开始新的匹配
+#define LZ4_SKIP_SHIFT    6   // 连续找不到匹配时逐渐加大步长 (不可压缩的数据很快扫完)
+
+// 按字节读取4字节 (输入不一定对齐)
+static uint32 read32(const uint8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static uint32 lz4_hash(uint32 v)
+{
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// 辅助：写出长度的扩展字节 (len 已经减去了token中的15)
+static uint8 *put_length(uint8 *op, uint32 len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/*
+ * 辅助：输出一个序列, mlen 为0时是只有字面量的最后一个序列
+ * 空间不够返回NULL
+ */
+static uint8 *put_sequence(uint8 *op, uint8 *oend, const uint8 *lit, uint32 nlit, uint32 offset, uint32 mlen)
+{
+    uint32 need = 1 + nlit + nlit / 255 + 1;
+    if (mlen)
+        need += 2 + (mlen - LZ4_MIN_MATCH) / 255 + 1;
+    if (need > (uint32)(oend - op))
+        return NULL;
+
+    uint8 *token = op++;
+    uint8 t = (nlit >= 15 ? 15 : nlit) << 4;
+    if (nlit >= 15)
+        op = put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen) {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        uint32 m = mlen - LZ4_MIN_MATCH;
+        t |= m >= 15 ? 15 : m;
+        if (m >= 15)
+            op = put_length(op, m - 15);
+    }
+    *token = t;
+    return op;
+}
+
+/*
+ * 把 [src, src + len) 压缩到 dst (最多 cap 字节)
+ * table 是 LZ4_HASH_SIZE 项的工作区, len 不超过 LZ4_MAX_INPUT
+ * 返回压缩后的长度, 放不下(压缩效果不好)返回0
+ */
+uint32 lz4_compress(const uint8 *src, uint32 len, uint8 *dst, uint32 cap, uint16 *table)
+{
+    const uint8 *ip = src, *anchor = src;
+    const uint8 *end = src + len;
+    const uint8 *mflimit = len > LZ4_MFLIMIT ? end - LZ4_MFLIMIT : src;
+    const uint8 *mlimit = end - LZ4_LAST_LITERALS;
+    uint8 *op = dst, *oend = dst + cap;
+
+    if (len > LZ4_MAX_INPUT)
+        return 0;
+    memset(table, 0, LZ4_HASH_SIZE * sizeof(uint16));
+
+    while (ip < mflimit) {
+        uint32 h = lz4_hash(read32(ip));
+        const uint8 *ref = src + table[h];
+        table[h] = ip - src;
+
+        if (ref >= ip || read32(ref) != read32(ip)) {
+            ip += 1 + ((ip - anchor) >> LZ4_SKIP_SHIFT);
+            continue;
+        }
+
+        // 向后延伸匹配, 再向前吞掉相同的字面量
+        const uint8 *mp = ip + LZ4_MIN_MATCH, *rp = ref + LZ4_MIN_MATCH;
+        while (mp < mlimit && *mp == *rp)
+            mp++, rp++;
+        while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            ip--, ref--;
+
+        op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+        if (op == NULL)
+            return 0;
+        ip = anchor = mp;
+    }
+
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op == NULL ? 0 : op - dst;
+}
+
+// 辅助：读取长度的扩展字节, 输入不完整返回false
+static bool get_length(const uint8 **ip, const uint8 *iend, uint32 *len)
+{
+    uint8 b;
+    do {
+        if (*ip >= iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+/*
+ * 把 [src, src + len) 解压到 dst (最多 cap 字节)
+ * 检查所有的长度和偏移, 数据损坏时返回-1而不会越界, 否则返回解压后的长度
+ */
+int lz4_decompress(const uint8 *src, uint32 len, uint8 *dst, uint32 cap)
+{
+    const uint8 *ip = src, *iend = src + len;
+    uint8 *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        uint8 token = *ip++;
+
+        uint32 nlit = token >> 4;
+        if (nlit == 15 && !get_length(&ip, iend, &nlit))
+            return -1;
+        if (nlit > (uint32)(iend - ip) || nlit > (uint32)(oend - op))
+            return -1;
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        // 最后一个序列只有字面量
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        uint32 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32)(op - dst))
+            return -1;
+
+        uint32 mlen = token & 15;
+        if (mlen == 15 && !get_length(&ip, iend, &mlen))
+            return -1;
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > (uint32)(oend - op))
+            return -1;
+
+        // 偏移小于长度时源和目的重叠(重复的模式), 只能逐字节复制
+        const uint8 *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--)
+                *op++ = *ref++;
+        }
+    }
+    return op - dst;
+}
@@ -29,8 +29,19 @@ proc_t *myproc(void);
 
 /* utils.c: 一些常用的工具函数 */
 
+void mem_init();
+uint64 mem_bench(int op, int impl, uint32 size, uint32 rounds);
 void memset(void *begin, uint8 data, uint32 n);
 void memmove(void *dst, const void *src, uint32 n);
 void *memcpy(void *dst, const void *src, uint32 n);
 int strncmp(const char *p, const char *q, uint32 n);
 int strlen(const char *str);
+
+/* dtb.c: 解析设备树 */
+
+void dtb_init(uint64 dtb);
+
+/* lz4.c: LZ4块压缩 */
+
+uint32 lz4_compress(const uint8 *src, uint32 len, uint8 *dst, uint32 cap, uint16 *table);
+int lz4_decompress(const uint8 *src, uint32 len, uint8 *dst, uint32 cap);
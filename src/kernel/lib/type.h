@@ -39,6 +39,73 @@
 #define ALIGN_UP(addr, refer) (((addr) + (refer) - 1) & ~((refer) - 1)) // 向上对齐
 #define ALIGN_DOWN(addr, refer) ((addr) & ~((refer) - 1))               // 向下对齐
 
+/*
+    memset/memmove/memcpy有三种实现:
+    - byte: 逐字节处理 (只用于对比测试)
+    - word: 对齐之后每次处理8字节并展开循环, 源和目的无法同时对齐时退回逐字节
+    - rvv: RISC-V向量扩展 (lib/memvec.S), 启动时发现hart打开了向量单元才会使用
+    向量寄存器不属于进程上下文, 使用期间关中断(push_off)防止被切换出去,
+    并且只在使用期间打开sstatus.VS, 返回用户态时它总是Off (用户程序不能使用向量指令)
+    长度不到MEM_RVV_MIN时向量指令的启动开销不划算, 仍然使用word实现
+*/
+#define MEM_IMPL_BYTE 0
+#define MEM_IMPL_WORD 1
+#define MEM_IMPL_RVV  2
+
+#define MEM_RVV_MIN 64
+
+// mem_bench的op
+#define MEM_OP_SET  0 // memset
+#define MEM_OP_COPY 1 // memcpy
+#define MEM_OP_MOVE 2 // memmove (目的地址在源地址之后且重叠, 需要从后向前)
+
+#define MEM_BENCH_MAX (64 * 1024) // 测试的最大长度
+
+/*
+    LZ4块格式 (lib/lz4.c): 一串序列, 每个序列是 token + 字面量 + 匹配
+    - token高4位是字面量长度, 低4位是匹配长度-4, 等于15时后面跟着若干个加到长度上的字节(255表示还有)
+    - 匹配用2字节小端的偏移指向已经输出的数据, 可以与自身重叠
+    - 最后一个序列只有字面量; 最后5个字节总是字面量, 最后12个字节内不会开始新的匹配
+    压缩器用哈希表记住每个4字节串最近出现的位置, 贪心地找匹配, 不追求最优
+*/
+#define LZ4_HASH_LOG   12
+#define LZ4_HASH_SIZE  (1 << LZ4_HASH_LOG)   // 压缩时需要的哈希表项数 (uint16, 由调用者提供)
+#define LZ4_MAX_INPUT  65535                 // 偏移只有16位, 一次最多压缩的长度
+
+/*
+    设备树(FDT, lib/dtb.c): QEMU 把它的物理地址放在 a1 中交给 _entry, 内容都是大端序
+    - 头部之后是结构块: 一串32位的token, BEGIN_NODE(节点名) ... PROP(长度, 属性名偏移, 值) ... END_NODE
+    - 属性名集中存放在字符串块中, 节点名和属性值都按4字节对齐
+    启动时只读出内存的范围和hart的数量 (boot_info), 之后设备树所在的内存会被当作空闲内存使用
+*/
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+typedef struct fdt_header {
+    uint32 magic;
+    uint32 totalsize;
+    uint32 off_dt_struct;
+    uint32 off_dt_strings;
+    uint32 off_mem_rsvmap;
+    uint32 version;
+    uint32 last_comp_version;
+    uint32 boot_cpuid_phys;
+    uint32 size_dt_strings;
+    uint32 size_dt_struct;
+} fdt_header_t;
+
+// 启动时发现的硬件规模 (没有设备树时使用 kernel.ld 的 ALLOC_END 和 NCPU)
+typedef struct boot_info {
+    uint32 ncpu;       // hart数量, 不超过NCPU
+    uint64 mem_end;    // 内存的结束地址 (从KERNEL_BASE开始)
+} boot_info_t;
+
+extern boot_info_t boot_info;
+
 // CPU
 typedef struct cpu
 {
@@ -1,26 +1,5 @@
 #include "mod.h"
 
-// 从begin开始对连续n个字节赋值data
-void memset(void *begin, uint8 data, uint32 n)
-{
-    uint8 *list = (uint8 *)begin;
-    for (uint32 i = 0; i < n; i++)
-        list[i] = data;
-}
-
-// 从src向dst拷贝n个字节的数据
-void memmove(void *dst, const void *src, uint32 n)
-{
-    char *d = dst;
-    const char *s = src;
-    while (n--)
-    {
-        *d = *s;
-        d++;
-        s++;
-    }
-}
-
 // 字符串p的前n个字符与q做比较
 // 按照ASCII码大小逐个比较
 // 相同返回0 大于或小于返回正数或负数
@@ -73,18 +52,216 @@ char* strncpy(char *s, const char *t, int n)
     return os;
 }
 
-/* --- append to src/kernel/lib/utils.c --- */
+/*------------------------------ 内存操作 ------------------------------*/
+
+// lib/memvec.S
+extern void memset_rvv(void *dst, uint8 data, uint32 n);
+extern void memcpy_rvv(void *dst, const void *src, uint32 n);
+extern void memmove_rvv(void *dst, const void *src, uint32 n);
+
+static int mem_impl = MEM_IMPL_WORD;
 
-void* memcpy(void *dst, const void *src, uint32 n)
+/* 选择内存操作的实现 (start在M-mode下为支持V扩展的hart打开了向量单元) */
+void mem_init()
 {
-    // memcpy 通常不处理重叠，但为了安全和简单，我们这里可以直接复用 memmove 逻辑
-    // 或者直接写一个简单的前向拷贝
-    char *s = (char *)src;
-    char *d = (char *)dst;
-    
-    // 简单的从前往后拷贝
-    while (n-- > 0)
+    if (r_sstatus() & SSTATUS_VS)
+        mem_impl = MEM_IMPL_RVV;
+    // 向量单元平时关闭, 用到时再打开
+    w_sstatus(r_sstatus() & ~SSTATUS_VS);
+}
+
+static void memset_byte(void *begin, uint8 data, uint32 n)
+{
+    uint8 *list = (uint8 *)begin;
+    for (uint32 i = 0; i < n; i++)
+        list[i] = data;
+}
+
+static void memset_word(void *begin, uint8 data, uint32 n)
+{
+    uint8 *d = begin;
+    while (n > 0 && ((uint64)d & 7)) {
+        *d++ = data;
+        n--;
+    }
+
+    uint64 w = data * 0x0101010101010101ul;
+    uint64 *dw = (uint64 *)d;
+    for (; n >= 32; n -= 32, dw += 4) {
+        dw[0] = w;
+        dw[1] = w;
+        dw[2] = w;
+        dw[3] = w;
+    }
+    for (; n >= 8; n -= 8)
+        *dw++ = w;
+
+    d = (uint8 *)dw;
+    while (n--)
+        *d++ = data;
+}
+
+// 从前向后拷贝
+static void copy_forward_byte(uint8 *d, const uint8 *s, uint32 n)
+{
+    while (n--)
         *d++ = *s++;
-        
+}
+
+static void copy_forward_word(uint8 *d, const uint8 *s, uint32 n)
+{
+    // 非对齐的8字节访问可能触发异常, 两边无法同时对齐时只能逐字节
+    if (((uint64)d ^ (uint64)s) & 7) {
+        copy_forward_byte(d, s, n);
+        return;
+    }
+    while (n > 0 && ((uint64)d & 7)) {
+        *d++ = *s++;
+        n--;
+    }
+
+    uint64 *dw = (uint64 *)d;
+    const uint64 *sw = (const uint64 *)s;
+    for (; n >= 32; n -= 32, dw += 4, sw += 4) {
+        uint64 a = sw[0], b = sw[1], c = sw[2], e = sw[3];
+        dw[0] = a;
+        dw[1] = b;
+        dw[2] = c;
+        dw[3] = e;
+    }
+    for (; n >= 8; n -= 8)
+        *dw++ = *sw++;
+
+    copy_forward_byte((uint8 *)dw, (const uint8 *)sw, n);
+}
+
+// 从后向前拷贝 (目的地址在源地址之后且有重叠)
+static void copy_backward_byte(uint8 *d, const uint8 *s, uint32 n)
+{
+    d += n;
+    s += n;
+    while (n--)
+        *--d = *--s;
+}
+
+static void copy_backward_word(uint8 *d, const uint8 *s, uint32 n)
+{
+    if (((uint64)d ^ (uint64)s) & 7) {
+        copy_backward_byte(d, s, n);
+        return;
+    }
+    d += n;
+    s += n;
+    while (n > 0 && ((uint64)d & 7)) {
+        *--d = *--s;
+        n--;
+    }
+
+    uint64 *dw = (uint64 *)d;
+    const uint64 *sw = (const uint64 *)s;
+    for (; n >= 32; n -= 32) {
+        dw -= 4;
+        sw -= 4;
+        uint64 a = sw[3], b = sw[2], c = sw[1], e = sw[0];
+        dw[3] = a;
+        dw[2] = b;
+        dw[1] = c;
+        dw[0] = e;
+    }
+    for (; n >= 8; n -= 8)
+        *--dw = *--sw;
+
+    d = (uint8 *)dw;
+    s = (const uint8 *)sw;
+    while (n--)
+        *--d = *--s;
+}
+
+// 按实现impl执行内存操作op (mem_bench也通过它选择实现)
+static void mem_op(int op, int impl, void *dst, const void *src, uint8 data, uint32 n)
+{
+    bool backward = (uint64)dst > (uint64)src && (uint64)dst < (uint64)src + n;
+
+    if (impl == MEM_IMPL_RVV) {
+        // 只在这里打开向量单元, 用完关掉: 向量寄存器不保存, 用户态也不能使用它们
+        push_off();
+        w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+        if (op == MEM_OP_SET)
+            memset_rvv(dst, data, n);
+        else if (op == MEM_OP_COPY || !backward)
+            memcpy_rvv(dst, src, n);
+        else
+            memmove_rvv(dst, src, n);
+        w_sstatus(r_sstatus() & ~SSTATUS_VS);
+        pop_off();
+    } else if (impl == MEM_IMPL_WORD) {
+        if (op == MEM_OP_SET)
+            memset_word(dst, data, n);
+        else if (op == MEM_OP_COPY || !backward)
+            copy_forward_word(dst, src, n);
+        else
+            copy_backward_word(dst, src, n);
+    } else {
+        if (op == MEM_OP_SET)
+            memset_byte(dst, data, n);
+        else if (op == MEM_OP_COPY || !backward)
+            copy_forward_byte(dst, src, n);
+        else
+            copy_backward_byte(dst, src, n);
+    }
+}
+
+// 短的操作不值得启动向量单元
+static int mem_pick(uint32 n)
+{
+    return (mem_impl == MEM_IMPL_RVV && n < MEM_RVV_MIN) ? MEM_IMPL_WORD : mem_impl;
+}
+
+// 从begin开始对连续n个字节赋值data
+void memset(void *begin, uint8 data, uint32 n)
+{
+    mem_op(MEM_OP_SET, mem_pick(n), begin, NULL, data, n);
+}
+
+// 从src向dst拷贝n个字节的数据 (允许重叠)
+void memmove(void *dst, const void *src, uint32 n)
+{
+    mem_op(MEM_OP_MOVE, mem_pick(n), dst, src, 0, n);
+}
+
+// 从src向dst拷贝n个字节的数据 (不允许重叠)
+void *memcpy(void *dst, const void *src, uint32 n)
+{
+    mem_op(MEM_OP_COPY, mem_pick(n), dst, src, 0, n);
     return dst;
-}
\ No newline at end of file
+}
+
+/*
+ * 内存操作吞吐量测试: 用实现impl对size字节执行rounds次操作op
+ * 返回消耗的时钟周期, 参数不合法或者没有连续内存返回0
+ */
+uint64 mem_bench(int op, int impl, uint32 size, uint32 rounds)
+{
+    if (op < MEM_OP_SET || op > MEM_OP_MOVE || impl < MEM_IMPL_BYTE || impl > MEM_IMPL_RVV)
+        return 0;
+    if (size == 0 || size > MEM_BENCH_MAX || (impl == MEM_IMPL_RVV && mem_impl != MEM_IMPL_RVV))
+        return 0;
+
+    // 源和目的各占一半 (memmove时目的与源重叠, 错开64字节)
+    uint32 order = 0;
+    while (((uint64)PGSIZE << order) < 2 * MEM_BENCH_MAX)
+        order++;
+    uint8 *buf = pmem_alloc_pages(order, true);
+    if (buf == NULL)
+        return 0;
+    uint8 *src = buf;
+    uint8 *dst = (op == MEM_OP_MOVE) ? buf + 64 : buf + MEM_BENCH_MAX;
+
+    uint64 begin = r_time();
+    for (uint32 r = 0; r < rounds; r++)
+        mem_op(op, impl, dst, src, (uint8)r, size);
+    uint64 cycles = r_time() - begin;
+
+    pmem_free_pages((uint64)buf, order, true);
+    return cycles;
+}
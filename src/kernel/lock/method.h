@@ -5,6 +5,7 @@
 void push_off();
 void pop_off();
 
+void spinlock_set_poll(void (*fn)(void));
 void spinlock_init(spinlock_t *lk, char *name);
 bool spinlock_holding(spinlock_t *lk);
 void spinlock_acquire(spinlock_t *lk);
@@ -59,6 +59,7 @@ void sleeplock_acquire(sleeplock_t *slk)
     // 3. 抢到了锁，标记占用
     slk->locked = 1;
     slk->pid = myproc()->pid;
+    myproc()->nsleeplock++;
     
     // 4. 释放内部自旋锁
     spinlock_release(&slk->lock);
@@ -76,6 +77,7 @@ void sleeplock_release(sleeplock_t *slk)
     // 2. 清除占用状态
     slk->locked = 0;
     slk->pid = 0;
+    myproc()->nsleeplock--;
     
     // 3. 唤醒等待队列中的进程
     // 它们醒来后会继续在 acquire 的 while 循环中竞争锁
@@ -1,5 +1,8 @@
 #include "mod.h"
 
+// 关着中断自旋等锁时调用, 处理本该由中断处理的请求 (由trap层登记, 见 spinlock_set_poll)
+static void (*spin_poll)(void);
+
 /*
     开关中断的基本逻辑:
     1. 多个地方可能开关中断, 因此它不是“开/关”的二元状态，而是“关 关 关 开 开 开”的stack
@@ -32,6 +35,15 @@ void pop_off(void)
 }
 
 
+/*
+ * 登记自旋等待期间的轮询函数 (启动时在其他CPU开始运行之前调用一次)
+ * 持锁者可能正在等待我们应答IPI, 而我们关着中断收不到它
+ */
+void spinlock_set_poll(void (*fn)(void))
+{
+    spin_poll = fn;
+}
+
 // 自旋锁初始化
 void spinlock_init(spinlock_t *lk, char *name)
 {
@@ -58,8 +70,11 @@ void spinlock_acquire(spinlock_t *lk)
 
     // 原子操作：尝试将 locked 设置为 1
     // 如果原来就是 1，则循环等待 (spin)
-    while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
-        ;
+    // 等待期间关着中断, 顺便处理其他CPU发来的请求 (持锁者可能正在等我们应答)
+    while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+        if (spin_poll != NULL)
+            spin_poll();
+    }
 
     // 内存屏障，保证临界区代码不被乱序到锁获取之前
     __sync_synchronize();
@@ -7,6 +7,8 @@
 
 volatile static int started = 0;
 
+extern uint64 boot_dtb; // from start.c
+
 int main()
 {
     int cpuid = r_tp();
@@ -14,11 +16,17 @@ int main()
     if (cpuid == 0) {
 
         print_init();
+        mem_init();
         printf("cpu %d is booting!\n", cpuid);
 
+        dtb_init(boot_dtb);
         pmem_init();
+        kmem_init();
         kvm_init();
+        vmalloc_init();
         kvm_inithart();
+        uvm_asid_init();
+        ksm_init();
         mmap_init();
         virtio_disk_init();
         proc_init();
@@ -0,0 +1,312 @@
+#include "mod.h"
+
+// kmalloc使用的各个大小类别的cache: 16B 32B ... 2KB
+static kmem_cache_t kmalloc_caches[KMALLOC_NR_CLASS];
+static char *kmalloc_names[KMALLOC_NR_CLASS] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+// 所有kmem_cache组成的链表 (只增不减)
+static kmem_cache_t *cache_list;
+static spinlock_t cache_list_lk;
+
+/*------------------------------ slab 链表操作 ------------------------------*/
+
+static void slab_list_init(slab_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void slab_list_add(slab_t *head, slab_t *s)
+{
+    s->next = head->next;
+    s->prev = head;
+    head->next->prev = s;
+    head->next = s;
+}
+
+static void slab_list_del(slab_t *s)
+{
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+/*------------------------------ slab 的申请与释放 ------------------------------*/
+
+/*
+ * 把新页面 page 做成cache的一个slab并挂到partial链表
+ * 调用者需要持有c->lk
+ */
+static void cache_grow(kmem_cache_t *c, uint64 page)
+{
+    pmem_page(page)->flags |= PAGE_SLAB;
+
+    slab_t *s = (slab_t *)page;
+    s->cache = c;
+    s->inuse = 0;
+    s->free = NULL;
+
+    // 倒序串起来, 这样分配时是按地址递增的顺序
+    for (int i = c->objs_per_slab - 1; i >= 0; i--) {
+        kmem_obj_t *obj = (kmem_obj_t *)(page + c->obj_offset + i * c->obj_size);
+        obj->next = s->free;
+        s->free = obj;
+    }
+
+    slab_list_add(&c->partial, s);
+    c->nr_slabs++;
+    c->nr_free += c->objs_per_slab;
+}
+
+/*
+ * 从slab中取一个对象, 没有空闲对象时申请新的slab
+ * 调用者需要持有c->lk, 申请页面期间会暂时放开它:
+ * 分配页面可能进入回收, shrinker释放对象时会获取同一个cache的c->lk
+ */
+static kmem_obj_t *slab_get_obj(kmem_cache_t *c)
+{
+    if (c->partial.next == &c->partial) {
+        spinlock_release(&c->lk);
+        uint64 page = (uint64)pmem_alloc_flags(true, 0);
+        spinlock_acquire(&c->lk);
+
+        // 放开锁期间其他人(或者回收路径)可能已经还回了对象
+        if (c->partial.next == &c->partial)
+            cache_grow(c, page);
+        else
+            pmem_free(page, true);
+    }
+
+    slab_t *s = c->partial.next;
+    kmem_obj_t *obj = s->free;
+    s->free = obj->next;
+    s->inuse++;
+    c->nr_free--;
+
+    // slab满了: 移到full链表
+    if (s->free == NULL) {
+        slab_list_del(s);
+        slab_list_add(&c->full, s);
+    }
+    return obj;
+}
+
+/*
+ * 把一个对象还给它所在的slab
+ * slab完全空闲且cache中还有至少一个slab的空闲对象时, 把slab页面还给伙伴系统
+ * 调用者需要持有c->lk
+ */
+static void slab_put_obj(kmem_cache_t *c, kmem_obj_t *obj)
+{
+    slab_t *s = (slab_t *)ALIGN_DOWN((uint64)obj, PGSIZE);
+
+    if (s->cache != c)
+        panic("kmem_cache_free: object not in this cache");
+
+    // slab原本是满的: 移回partial链表
+    if (s->free == NULL) {
+        slab_list_del(s);
+        slab_list_add(&c->partial, s);
+    }
+
+    obj->next = s->free;
+    s->free = obj;
+    s->inuse--;
+    c->nr_free++;
+
+    if (s->inuse == 0 && c->nr_free >= 2 * c->objs_per_slab) {
+        slab_list_del(s);
+        c->nr_slabs--;
+        c->nr_free -= c->objs_per_slab;
+        pmem_page((uint64)s)->flags &= ~PAGE_SLAB;
+        pmem_free((uint64)s, true);
+    }
+}
+
+/*------------------------------ kmem_cache 接口 ------------------------------*/
+
+/* 初始化一个cache (不申请任何slab) */
+static void cache_setup(kmem_cache_t *c, char *name, uint32 size)
+{
+    c->name = name;
+    c->obj_size = ALIGN_UP(MAX(size, sizeof(kmem_obj_t)), 8);
+    c->obj_offset = ALIGN_UP(sizeof(slab_t), MIN(c->obj_size, 64));
+    c->objs_per_slab = (PGSIZE - c->obj_offset) / c->obj_size;
+    if (c->objs_per_slab == 0)
+        panic("kmem_cache: object too large");
+
+    spinlock_init(&c->lk, name);
+    slab_list_init(&c->partial);
+    slab_list_init(&c->full);
+    c->nr_slabs = 0;
+    c->nr_free = 0;
+    for (int i = 0; i < NCPU; i++) {
+        c->cpu[i].count = 0;
+        c->cpu[i].head = NULL;
+    }
+
+    spinlock_acquire(&cache_list_lk);
+    c->next = cache_list;
+    cache_list = c;
+    spinlock_release(&cache_list_lk);
+}
+
+/* slab分配器初始化 (需要在pmem_init之后) */
+void kmem_init()
+{
+    spinlock_init(&cache_list_lk, "kmem_cache_list");
+    for (int i = 0; i < KMALLOC_NR_CLASS; i++)
+        cache_setup(&kmalloc_caches[i], kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i));
+}
+
+/*
+ * 创建一个专用于某种对象的cache
+ * 对象大小不能超过 PGSIZE - sizeof(slab_t)
+ */
+kmem_cache_t *kmem_cache_create(char *name, uint32 size)
+{
+    kmem_cache_t *c = kmalloc(sizeof(kmem_cache_t));
+    if (c == NULL)
+        panic("kmem_cache_create: no memory");
+    cache_setup(c, name, size);
+    return c;
+}
+
+/*
+ * 从cache分配一个对象 (内容不确定)
+ * 物理内存回收后仍然耗尽时由pmem_alloc panic
+ */
+void *kmem_cache_alloc(kmem_cache_t *c)
+{
+    kmem_obj_t *obj;
+
+    push_off();
+    kmem_cpu_t *cc = &c->cpu[mycpuid()];
+
+    // 私有链表空了: 从slab批量取一些对象
+    if (cc->count == 0) {
+        spinlock_acquire(&c->lk);
+        for (int i = 0; i < KMEM_CPU_BATCH; i++) {
+            obj = slab_get_obj(c);
+            obj->next = cc->head;
+            cc->head = obj;
+            cc->count++;
+        }
+        spinlock_release(&c->lk);
+    }
+
+    obj = cc->head;
+    cc->head = obj->next;
+    cc->count--;
+    pop_off();
+
+    return (void *)obj;
+}
+
+/* 把对象还给cache */
+void kmem_cache_free(kmem_cache_t *c, void *ptr)
+{
+    kmem_obj_t *obj = (kmem_obj_t *)ptr;
+
+    push_off();
+    kmem_cpu_t *cc = &c->cpu[mycpuid()];
+
+    // 私有链表满了: 先还一批给slab
+    if (cc->count >= KMEM_CPU_LIMIT) {
+        spinlock_acquire(&c->lk);
+        for (int i = 0; i < KMEM_CPU_BATCH; i++) {
+            kmem_obj_t *victim = cc->head;
+            cc->head = victim->next;
+            cc->count--;
+            slab_put_obj(c, victim);
+        }
+        spinlock_release(&c->lk);
+    }
+
+    obj->next = cc->head;
+    cc->head = obj;
+    cc->count++;
+    pop_off();
+}
+
+/*------------------------------ kmalloc 接口 ------------------------------*/
+
+/*
+ * 通用的内核内存分配 (内容不确定)
+ * 小对象来自对应大小类别的cache, 大于KMALLOC_MAX_SIZE的请求直接使用伙伴系统
+ * 大块内存没有足够的连续页面时返回NULL
+ */
+void *kmalloc(uint32 size)
+{
+    if (size == 0)
+        return NULL;
+
+    if (size <= KMALLOC_MAX_SIZE) {
+        int idx = 0;
+        while ((1u << (KMALLOC_MIN_SHIFT + idx)) < size)
+            idx++;
+        return kmem_cache_alloc(&kmalloc_caches[idx]);
+    }
+
+    uint32 order = 0;
+    while (((uint64)PGSIZE << order) < size)
+        order++;
+
+    void *ptr = pmem_alloc_pages(order, true);
+    if (ptr == NULL)
+        return NULL;
+
+    page_t *pg = pmem_page((uint64)ptr);
+    pg->flags |= PAGE_LARGE;
+    pg->order = order;
+    return ptr;
+}
+
+/* 释放kmalloc分配的内存 */
+void kfree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    uint64 page = ALIGN_DOWN((uint64)ptr, PGSIZE);
+    page_t *pg = pmem_page(page);
+
+    if (pg->flags & PAGE_SLAB) {
+        kmem_cache_free(((slab_t *)page)->cache, ptr);
+    } else if (pg->flags & PAGE_LARGE) {
+        if (page != (uint64)ptr)
+            panic("kfree: bad large pointer");
+        pg->flags &= ~PAGE_LARGE;
+        pmem_free_pages(page, pg->order, true);
+    } else {
+        panic("kfree: not a kmalloc pointer");
+    }
+}
+
+/*------------------------------ 调试输出 ------------------------------*/
+
+/* 输出一个cache的使用情况 */
+void kmem_cache_print(kmem_cache_t *c)
+{
+    uint32 cached = 0;
+    for (int i = 0; i < boot_info.ncpu; i++)
+        cached += c->cpu[i].count;
+
+    spinlock_acquire(&c->lk);
+    uint32 total = c->nr_slabs * c->objs_per_slab;
+    printf("%s: size = %d, slabs = %d, objects = %d/%d\n",
+        c->name, c->obj_size, c->nr_slabs, total - c->nr_free - cached, total);
+    spinlock_release(&c->lk);
+}
+
+/* 输出所有cache的使用情况 (for debug) */
+void kmem_print_info()
+{
+    spinlock_acquire(&cache_list_lk);
+    for (kmem_cache_t *c = cache_list; c != NULL; c = c->next)
+        kmem_cache_print(c);
+    spinlock_release(&cache_list_lk);
+}
@@ -0,0 +1,252 @@
+#include "mod.h"
+#include "../proc/mod.h"
+
+/*
+ * 同页合并 (设计见 type.h)
+ * 扫描只发生在时钟中断返回用户态之前, 持有ksm_lk; 需要修改其他进程的页表项时再持有它的p->lk
+ * 加锁顺序: ksm_lk -> p->lk
+ */
+
+static spinlock_t ksm_lk;                       // 保护下面两张表和统计
+static ksm_node_t *ksm_stable[KSM_HASH_SIZE];
+static ksm_node_t *ksm_unstable[KSM_HASH_SIZE];
+static uint32 ksm_nr_stable;
+static uint32 ksm_nr_unstable;
+static uint32 ksm_rounds;
+static kmem_cache_t *ksm_cache;
+
+// 统计信息
+static uint32 ksm_scanned;
+static uint32 ksm_merges;
+
+void ksm_init()
+{
+    spinlock_init(&ksm_lk, "ksm");
+    ksm_cache = kmem_cache_create("ksm_node", sizeof(ksm_node_t));
+}
+
+// 辅助：页面内容的哈希值 (FNV-1a, 每次处理8字节)
+static uint64 page_hash(uint64 pa)
+{
+    uint64 *w = (uint64 *)pa;
+    uint64 h = 0xcbf29ce484222325ul;
+    for (int i = 0; i < PGSIZE / 8; i++) {
+        h ^= w[i];
+        h *= 0x100000001b3ul;
+    }
+    return h;
+}
+
+// 辅助：两个页面的内容是否相同
+static bool page_same(uint64 pa1, uint64 pa2)
+{
+    uint64 *a = (uint64 *)pa1, *b = (uint64 *)pa2;
+    for (int i = 0; i < PGSIZE / 8; i++) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+// 辅助：合并后的权限 (只读, 原来可写的改为写时复制)
+static uint64 ksm_flags(pte_t pte)
+{
+    uint64 flags = PTE_FLAGS(pte) & ~(PTE_W | PTE_D);
+    if (pte & PTE_W)
+        flags |= PTE_COW;
+    return flags;
+}
+
+// 可以修改页表项的进程: 当前进程, 或者在用户态被抢占的进程 (调用者持有q->lk)
+static bool mergeable(proc_t *q)
+{
+    return q->pgtbl != NULL && (q == myproc() || (q->state == RUNNABLE && q->user_preempted));
+}
+
+// 辅助：清空不稳定表
+static void unstable_clear()
+{
+    for (int i = 0; i < KSM_HASH_SIZE; i++) {
+        while (ksm_unstable[i] != NULL) {
+            ksm_node_t *n = ksm_unstable[i];
+            ksm_unstable[i] = n->next;
+            kmem_cache_free(ksm_cache, n);
+        }
+    }
+    ksm_nr_unstable = 0;
+}
+
+// 辅助：当前进程 va 处的页面改为映射已经合并的页面 stable (调用者已经为它加了引用)
+static void map_stable(proc_t *p, pte_t *pte, uint64 va, uint64 stable)
+{
+    uint64 old = PTE_TO_PA(*pte);
+    *pte = PA_TO_PTE(stable) | ksm_flags(*pte);
+    uvm_flush_tlb(p->pgtbl, va, PGSIZE);
+    pmem_free(old, false);
+    ksm_merges++;
+}
+
+/*
+ * 辅助：在稳定表里找内容相同的页面并合并, 成功返回true
+ * 顺便释放只剩表自己引用的页面
+ */
+static bool merge_stable(proc_t *p, pte_t *pte, uint64 va, uint64 pa, uint64 hash)
+{
+    ksm_node_t **pp = &ksm_stable[hash % KSM_HASH_SIZE];
+    while (*pp != NULL) {
+        ksm_node_t *n = *pp;
+        if (pmem_page(n->pa)->ref == 1) {
+            *pp = n->next;
+            pmem_free(n->pa, false);
+            kmem_cache_free(ksm_cache, n);
+            ksm_nr_stable--;
+            continue;
+        }
+        if (n->hash == hash && page_same(n->pa, pa)) {
+            pmem_page_get(n->pa);
+            map_stable(p, pte, va, n->pa);
+            return true;
+        }
+        pp = &n->next;
+    }
+    return false;
+}
+
+/*
+ * 辅助：在不稳定表里找内容相同的页面, 找到后把它变成稳定页面再合并
+ * 对方的页表项在持有它的p->lk时改为只读, 同时给页面加上稳定表和我们的引用,
+ * 这样对方放开锁之后再写入也只会复制出去
+ * 找不到时把自己记进不稳定表
+ */
+static void merge_unstable(proc_t *p, pte_t *pte, uint64 va, uint64 pa, uint64 hash)
+{
+    ksm_node_t **pp = &ksm_unstable[hash % KSM_HASH_SIZE];
+    for (; *pp != NULL; pp = &(*pp)->next) {
+        ksm_node_t *n = *pp;
+        if (n->hash != hash)
+            continue;
+        if (n->proc == p && n->pid == p->pid && n->va == va)
+            return; // 上一轮已经记下了自己
+
+        proc_t *q = n->proc;
+        bool ok = false;
+        spinlock_acquire(&q->lk);
+        if (q->pid == n->pid && mergeable(q)) {
+            int lv = -1;
+            pte_t *qpte = __vm_getpte(q->pgtbl, n->va, false, 0, &lv);
+            if (qpte != NULL && lv == 0 && (*qpte & PTE_V) && PTE_TO_PA(*qpte) == n->pa &&
+                n->pa != pa && pmem_page(n->pa)->ref == 1 && page_same(n->pa, pa)) {
+                *qpte = PA_TO_PTE(n->pa) | ksm_flags(*qpte);
+                uvm_flush_tlb_proc(q, n->va, PGSIZE);
+                pmem_page_get(n->pa); // 稳定表的引用
+                pmem_page_get(n->pa); // 我们的引用
+                ok = true;
+            }
+        }
+        spinlock_release(&q->lk);
+        if (!ok)
+            continue;
+
+        // 表项从不稳定表移到稳定表
+        *pp = n->next;
+        ksm_nr_unstable--;
+        n->proc = NULL;
+        n->next = ksm_stable[hash % KSM_HASH_SIZE];
+        ksm_stable[hash % KSM_HASH_SIZE] = n;
+        ksm_nr_stable++;
+        map_stable(p, pte, va, n->pa);
+        return;
+    }
+
+    if (ksm_nr_unstable >= KSM_UNSTABLE_MAX)
+        return;
+    ksm_node_t *n = kmem_cache_alloc(ksm_cache);
+    n->hash = hash;
+    n->pa = pa;
+    n->proc = p;
+    n->pid = p->pid;
+    n->va = va;
+    n->next = ksm_unstable[hash % KSM_HASH_SIZE];
+    ksm_unstable[hash % KSM_HASH_SIZE] = n;
+    ksm_nr_unstable++;
+}
+
+// 一次扫描的候选页面
+typedef struct ksm_batch {
+    uint32 n;
+    pte_t *pte[KSM_SCAN_PAGES];
+    uint64 va[KSM_SCAN_PAGES];
+    uint64 next;  // 选满时下一个没有扫描的地址 (0表示扫完了整个地址空间)
+} ksm_batch_t;
+
+// 辅助：挑选候选页面
+static void pick_one(pte_t *pte, uint64 va, int level, void *arg)
+{
+    ksm_batch_t *b = (ksm_batch_t *)arg;
+
+    if (b->n == KSM_SCAN_PAGES) {
+        if (b->next == 0)
+            b->next = va;
+        return;
+    }
+    if (level != 0 || !(*pte & PTE_U))
+        return;
+    uint64 pa = PTE_TO_PA(*pte);
+    if (pa == pmem_zero_page() || pmem_page(pa)->ref != 1)
+        return;
+    b->pte[b->n] = pte;
+    b->va[b->n] = va;
+    b->n++;
+}
+
+/* 从 p->ksm_va 开始扫描当前进程的一批页面, 合并内容相同的页面 */
+void ksm_scan()
+{
+    proc_t *p = myproc();
+    if (p == NULL || p->pgtbl == NULL)
+        return;
+
+    ksm_batch_t b;
+    b.n = 0;
+    b.next = 0;
+    if (p->ksm_va < USER_BASE || p->ksm_va >= TRAPFRAME)
+        p->ksm_va = USER_BASE;
+    vm_walk(p->pgtbl, p->ksm_va, TRAPFRAME - p->ksm_va, pick_one, &b);
+    p->ksm_va = b.next != 0 ? b.next : USER_BASE;
+
+    spinlock_acquire(&ksm_lk);
+    if (++ksm_rounds % KSM_UNSTABLE_ROUNDS == 0)
+        unstable_clear();
+    for (uint32 i = 0; i < b.n; i++) {
+        // 可能在前面作为不稳定表中的对方被合并了
+        uint64 pa = PTE_TO_PA(*b.pte[i]);
+        if (pmem_page(pa)->ref != 1)
+            continue;
+        uint64 hash = page_hash(pa);
+        ksm_scanned++;
+        if (!merge_stable(p, b.pte[i], b.va[i], pa, hash))
+            merge_unstable(p, b.pte[i], b.va[i], pa, hash);
+    }
+    spinlock_release(&ksm_lk);
+}
+
+/* 输出同页合并的统计 (for debug) */
+void ksm_print_info()
+{
+    uint32 shared = 0, saved = 0;
+
+    spinlock_acquire(&ksm_lk);
+    for (int i = 0; i < KSM_HASH_SIZE; i++) {
+        for (ksm_node_t *n = ksm_stable[i]; n != NULL; n = n->next) {
+            // 表自己有一个引用, 第一个映射是本来就要的
+            uint32 ref = pmem_page(n->pa)->ref;
+            if (ref > 1)
+                shared++;
+            if (ref > 2)
+                saved += ref - 2;
+        }
+    }
+    printf("ksm: shared = %d, saved = %d pages, scanned = %d, merges = %d, unstable = %d\n",
+           shared, saved, ksm_scanned, ksm_merges, ksm_nr_unstable);
+    spinlock_release(&ksm_lk);
+}
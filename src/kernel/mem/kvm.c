@@ -3,21 +3,27 @@
 // 全局内核页表根节点
 static pgtbl_t kern_pagetable;
 
+// 启动之后修改内核页表(内核栈和vmalloc)时持有: 相邻的映射可能共用同一个中间页表页,
+// 两个CPU同时发现它不存在时会各分配一个, 其中一边的映射就丢了
+static spinlock_t kvm_lk;
+
 /*
  * 在页表中查找虚拟地址对应的页表项(PTE)地址
- * level 2 -> level 1 -> level 0
+ * level 2 -> level 1 -> ... -> target_level
  * 如果 alloc 为 true，则在缺页时分配新的中间页表页
+ * 中途遇到叶子节点(大页映射)时直接返回该叶子
+ * 如果 level 非空, 通过它返回页表项所在的级别
  */
-pte_t *vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc)
+pte_t *__vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc, int target_level, int *level)
 {
     if (table == NULL) // [NEW] 处理pgtbl为NULL的情况
         table = kern_pagetable;
     if (virt_addr >= VA_MAX)
         return NULL;
 
-    for (int level = 2; level > 0; level--) {
+    for (int lv = 2; lv > target_level; lv--) {
         // 获取当前级页表的索引
-        uint64 idx = VA_TO_VPN(virt_addr, level);
+        uint64 idx = VA_TO_VPN(virt_addr, lv);
         pte_t *entry = &table[idx];
 
         // 如果页表项无效
@@ -33,159 +39,370 @@ pte_t *vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc)
             // 建立连接：当前PTE指向新的页表物理地址，并标记有效
             *entry = PA_TO_PTE((uint64)new_table) | PTE_V;
         } 
-        // 如果遇到了大页映射（叶子节点出现在中间层），这在当前设计中不应该发生
+        // 遇到了大页映射（叶子节点出现在中间层）
         // PTE_CHECK 为 false 表示有权限位，即为叶子节点
         else if (!PTE_CHECK(*entry)) {
-            return NULL;
+            if (level) *level = lv;
+            return entry;
         }
 
         // 进入下一级页表
         table = (pgtbl_t)PTE_TO_PA(*entry);
     }
 
-    // 返回最底层(level 0)的PTE地址
-    return &table[VA_TO_VPN(virt_addr, 0)];
+    if (level) *level = target_level;
+    return &table[VA_TO_VPN(virt_addr, target_level)];
+}
+
+/*
+ * 在页表中查找虚拟地址对应的页表项(PTE)地址
+ * 返回最底层(level 0)的PTE地址, 或者覆盖该地址的大页叶子
+ */
+pte_t *vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc)
+{
+    return __vm_getpte(table, virt_addr, alloc, 0, NULL);
 }
 
 /*
  * 建立内存映射：将虚拟地址区间 [virt_addr, virt_addr + len) 
  * 映射到物理地址 [phys_addr, phys_addr + len)
  * 权限位由 perm 指定
+ * 每一步选择不超过 max_level 且地址对齐、长度足够的最大页面:
+ * level 0 = 4KB, level 1 = 2MB, level 2 = 1GB
  */
-void vm_mappages(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm)
+void __vm_mappages(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm, int max_level)
 {
     // 确保地址页对齐
     if (virt_addr % PGSIZE != 0) panic("vm_mappages: virt_addr not aligned");
     if (phys_addr % PGSIZE != 0) panic("vm_mappages: phys_addr not aligned");
     if (len == 0) panic("vm_mappages: zero length");
 
-    uint64 last_addr = virt_addr + len - 1;
-    if (last_addr >= VA_MAX) panic("vm_mappages: address overflow");
+    uint64 end = ALIGN_UP(virt_addr + len, PGSIZE);
+    if (end - 1 >= VA_MAX || end < virt_addr) panic("vm_mappages: address overflow");
 
-    // 逐页建立映射
     uint64 curr_v = virt_addr;
     uint64 curr_p = phys_addr;
+    pgtbl_t leaf_table = NULL; // 上一个4KB页面所在的最后一级页表 (同一个2MB范围内不再从根查找)
     
-    while (true) {
+    while (curr_v < end) {
+        // 选择这一步使用的页面大小
+        int lv = max_level;
+        while (lv > 0 && (curr_v % LEVEL_SIZE(lv) != 0 || curr_p % LEVEL_SIZE(lv) != 0 ||
+                          end - curr_v < LEVEL_SIZE(lv)))
+            lv--;
+
         // 获取或创建 PTE
-        pte_t *entry = vm_getpte(table, curr_v, true);
-        if (entry == NULL) 
-            panic("vm_mappages: failed to get pte");
-        
-        // 如果该位置已经被映射且有效，通常不应重复映射（除非用于修改权限）
-        // 这里我们直接覆盖，或者可以加一个检查
-        if (*entry & PTE_V) {
-            // 允许覆盖映射，更新权限或物理地址
-            *entry = PA_TO_PTE(curr_p) | perm | PTE_V;
+        pte_t *entry;
+        if (lv == 0 && leaf_table != NULL && VA_TO_VPN(curr_v, 0) != 0) {
+            entry = &leaf_table[VA_TO_VPN(curr_v, 0)];
         } else {
-            // 新增映射
-            *entry = PA_TO_PTE(curr_p) | perm | PTE_V;
+            int got;
+            entry = __vm_getpte(table, curr_v, true, lv, &got);
+            if (entry == NULL) 
+                panic("vm_mappages: failed to get pte");
+            if (got != lv)
+                panic("vm_mappages: remap inside a huge page");
+            if (lv > 0 && (*entry & PTE_V) && PTE_CHECK(*entry))
+                panic("vm_mappages: huge page over a page table");
+            leaf_table = (lv == 0) ? entry - VA_TO_VPN(curr_v, 0) : NULL;
         }
-
-        // 检查是否处理完所有页面
-        if (curr_v == last_addr - (last_addr % PGSIZE))
-            break;
-        
-        curr_v += PGSIZE;
-        curr_p += PGSIZE;
         
-        // 简单的边界保护，防止回绕
-        if (curr_v < virt_addr) break; 
+        // 如果该位置已经被映射且有效，直接覆盖 (用于修改权限或物理地址)
+        *entry = PA_TO_PTE(curr_p) | perm | PTE_V;
+
+        curr_v += LEVEL_SIZE(lv);
+        curr_p += LEVEL_SIZE(lv);
+    }
+}
+
+/* 建立 4KB 页面的内存映射 */
+void vm_mappages(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm)
+{
+    __vm_mappages(table, virt_addr, phys_addr, len, perm, 0);
+}
+
+/* 建立内存映射, 对齐允许时使用 2MB/1GB 的大页 */
+void vm_mappages_huge(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm)
+{
+    __vm_mappages(table, virt_addr, phys_addr, len, perm, 2);
+}
+
+/*
+ * 把覆盖 virt_addr 的大页叶子拆成下一级的一整张页表, 映射和权限都不变
+ * 用户大页(PTE_U)的物理块同时拆成独立的页面, 之后可以逐页共享和释放
+ * virt_addr 处没有大页时什么也不做, 返回是否拆分了
+ * 原来的大页TLB表项与新的页表翻译结果相同, 调用者按自己修改的范围刷新即可
+ */
+bool vm_split_huge(pgtbl_t table, uint64 virt_addr)
+{
+    int lv;
+    pte_t *entry = __vm_getpte(table, virt_addr, false, 0, &lv);
+    if (entry == NULL || !(*entry & PTE_V) || lv == 0)
+        return false;
+
+    uint64 pa = PTE_TO_PA(*entry);
+    int flags = PTE_FLAGS(*entry);
+    if (flags & PTE_U) {
+        if (lv != 1)
+            panic("vm_split_huge: user gigapage");
+        pmem_split_pages(pa, THP_ORDER);
     }
+
+    pgtbl_t child = (pgtbl_t)pmem_alloc(true);
+    for (int i = 0; i < 512; i++)
+        child[i] = PA_TO_PTE(pa + i * LEVEL_SIZE(lv - 1)) | flags;
+    *entry = PA_TO_PTE((uint64)child) | PTE_V;
+    return true;
+}
+
+// 辅助：virt_addr 落在大页中间时把它拆开, 之后以 virt_addr 为边界的操作不会只覆盖大页的一部分
+static void split_at(pgtbl_t table, uint64 virt_addr)
+{
+    int lv;
+    pte_t *entry;
+    while ((entry = __vm_getpte(table, virt_addr, false, 0, &lv)) != NULL &&
+           (*entry & PTE_V) && lv > 0 && virt_addr % LEVEL_SIZE(lv) != 0)
+        vm_split_huge(table, virt_addr);
+}
+
+// 辅助：页表页中是否已经没有页表项 (交换项虽然无效, 也不能丢)
+static bool table_empty(pgtbl_t table)
+{
+    for (int i = 0; i < 512; i++)
+        if (table[i] != 0)
+            return false;
+    return true;
+}
+
+/*
+ * 辅助：解除第 lv 级页表 table 中 [start, end) 的映射
+ * 每个页表页只进入一次, 下一级页表因此变空时把它也释放掉
+ * 返回是否释放了页表页
+ */
+static bool unmap_range(pgtbl_t table, int lv, uint64 start, uint64 end, bool do_free)
+{
+    bool freed = false;
+
+    while (start < end) {
+        uint64 next = ALIGN_DOWN(start, LEVEL_SIZE(lv)) + LEVEL_SIZE(lv);
+        uint64 stop = MIN(next, end);
+        pte_t *entry = &table[VA_TO_VPN(start, lv)];
+
+        if (!(*entry & PTE_V)) {
+            // 本来就没有映射, 或者页面在交换区中
+            if (lv == 0 && PTE_IS_SWAP(*entry)) {
+                if (do_free)
+                    swap_free(PTE_TO_SLOT(*entry));
+                *entry = 0;
+            }
+        } else if (lv == 0) {
+            if (do_free) {
+                uint64 pa = PTE_TO_PA(*entry);
+                if (pa) pmem_free(pa, false);
+            }
+            *entry = 0;
+        } else if (!PTE_CHECK(*entry)) {
+            // 大页: 边界上的已经被 split_at 拆开, 这里一定是完整覆盖的
+            if (start % LEVEL_SIZE(lv) != 0 || stop != next)
+                panic("vm_unmappages: partial huge page");
+            // 内核直接映射的大页不能释放, 用户大页是一整个伙伴块
+            if (do_free && !(*entry & PTE_U))
+                panic("vm_unmappages: free kernel huge page");
+            if (do_free)
+                pmem_free_pages(PTE_TO_PA(*entry), THP_ORDER, false);
+            *entry = 0;
+        } else {
+            pgtbl_t child = (pgtbl_t)PTE_TO_PA(*entry);
+            freed |= unmap_range(child, lv - 1, start, stop, do_free);
+            if (table_empty(child)) {
+                *entry = 0;
+                pmem_free((uint64)child, true);
+                freed = true;
+            }
+        }
+        start = stop;
+    }
+    return freed;
 }
 
 /*
  * 解除映射：移除虚拟地址区间 [virt_addr, virt_addr + len) 的映射
  * 如果 do_free 为 true，则同时释放对应的物理页
+ * 区间边界落在大页中间时先把大页拆开, 区间内完整的用户大页整块释放
+ * 变空的中间页表页一并释放 (根页表除外)
+ * 返回是否释放了中间页表页: 此时TLB中可能缓存了指向它的非叶子表项, 调用者需要刷新整个地址空间
  */
-void vm_unmappages(pgtbl_t table, uint64 virt_addr, uint64 len, bool do_free)
+bool vm_unmappages(pgtbl_t table, uint64 virt_addr, uint64 len, bool do_free)
 {
     if (virt_addr % PGSIZE != 0) panic("vm_unmappages: unaligned addr");
     if (len == 0) panic("vm_unmappages: zero length");
 
-    uint64 curr = virt_addr;
-    uint64 end = virt_addr + len; // 这里的end是开区间边界
+    uint64 end = ALIGN_UP(virt_addr + len, PGSIZE);
+    if (end > VA_MAX || end < virt_addr) panic("vm_unmappages: address overflow");
 
-    // 向上取整处理len可能不对齐的情况
-    // 但逻辑上按照页遍历
-    for (; curr < end; curr += PGSIZE) {
-        pte_t *entry = vm_getpte(table, curr, false);
-        
-        // 如果PTE不存在或者无效，说明本来就没映射，跳过
-        if (entry == NULL || !(*entry & PTE_V))
-            continue;
-        
-        // [修复] 删除了错误的 Huge Page 检查
-        // vm_getpte 返回的是 Level 0 的 PTE。
-        // 有效的 Level 0 PTE *必须* 带有权限位（即 PTE_CHECK(*entry) == false）。
-        // 之前的代码在这里 panic 是错误的。
-
-        // 如果需要回收物理内存
-        if (do_free) {
-            uint64 pa = PTE_TO_PA(*entry);
-            if (pa) pmem_free(pa, false); 
+    if (table == NULL)
+        table = kern_pagetable;
+    split_at(table, virt_addr);
+    split_at(table, end);
+    return unmap_range(table, 2, virt_addr, end, do_free);
+}
+
+// 辅助：对第 lv 级页表 table 中 [start, end) 范围内的有效叶子(swap为真时改为交换项)调用 fn
+static void walk_range(pgtbl_t table, int lv, uint64 start, uint64 end, vm_walk_fn_t fn, void *arg, bool swap)
+{
+    while (start < end) {
+        uint64 next = ALIGN_DOWN(start, LEVEL_SIZE(lv)) + LEVEL_SIZE(lv);
+        uint64 stop = MIN(next, end);
+        pte_t *entry = &table[VA_TO_VPN(start, lv)];
+
+        if (*entry & PTE_V) {
+            if (lv > 0 && PTE_CHECK(*entry))
+                walk_range((pgtbl_t)PTE_TO_PA(*entry), lv - 1, start, stop, fn, arg, swap);
+            else if (!swap)
+                fn(entry, ALIGN_DOWN(start, LEVEL_SIZE(lv)), lv, arg);
+        } else if (swap && lv == 0 && PTE_IS_SWAP(*entry)) {
+            fn(entry, start, 0, arg);
         }
-        
-        // 清空页表项
-        *entry = 0;
+        start = stop;
     }
 }
 
+/*
+ * 遍历 [virt_addr, virt_addr + len) 中所有有效的叶子页表项 (按地址递增的顺序)
+ * 每个页表页只进入一次, 没有映射的部分整个跳过
+ * fn 可以修改页表项, 但不能增删页表页
+ */
+void vm_walk(pgtbl_t table, uint64 virt_addr, uint64 len, vm_walk_fn_t fn, void *arg)
+{
+    uint64 end = ALIGN_UP(virt_addr + len, PGSIZE);
+    if (end > VA_MAX || end < virt_addr) panic("vm_walk: address overflow");
+
+    if (table == NULL)
+        table = kern_pagetable;
+    walk_range(table, 2, ALIGN_DOWN(virt_addr, PGSIZE), end, fn, arg, false);
+}
+
+/* 与 vm_walk 相同, 但遍历的是 [virt_addr, virt_addr + len) 中的交换项 (fn 收到的 level 总是0) */
+void vm_walk_swap(pgtbl_t table, uint64 virt_addr, uint64 len, vm_walk_fn_t fn, void *arg)
+{
+    uint64 end = ALIGN_UP(virt_addr + len, PGSIZE);
+    if (end > VA_MAX || end < virt_addr) panic("vm_walk_swap: address overflow");
+
+    walk_range(table, 2, ALIGN_DOWN(virt_addr, PGSIZE), end, fn, arg, true);
+}
+
+// vm_protect 的参数
+typedef struct protect_arg {
+    int clear;
+    int set;
+    uint32 count;
+} protect_arg_t;
+
+static void protect_one(pte_t *pte, uint64 va, int level, void *arg)
+{
+    protect_arg_t *pa = (protect_arg_t *)arg;
+    if (*pte & pa->clear) {
+        *pte = (*pte & ~(pte_t)pa->clear) | pa->set;
+        pa->count++;
+    }
+}
+
+/*
+ * 批量修改权限：区间内带有 clear 中任一权限位的页面, 去掉 clear 并加上 set
+ * (例如 fork 时把所有可写页面变成写时复制: clear = PTE_W, set = PTE_COW)
+ * 只覆盖一部分的大页先拆开
+ * 返回修改了多少个页表项 (为0时不需要刷新TLB)
+ */
+uint32 vm_protect(pgtbl_t table, uint64 virt_addr, uint64 len, int clear, int set)
+{
+    protect_arg_t arg = { .clear = clear, .set = set, .count = 0 };
+    uint64 end = ALIGN_UP(virt_addr + len, PGSIZE);
+
+    if (table == NULL)
+        table = kern_pagetable;
+    split_at(table, ALIGN_DOWN(virt_addr, PGSIZE));
+    split_at(table, end);
+    vm_walk(table, virt_addr, len, protect_one, &arg);
+    return arg.count;
+}
+
 /*
  * 初始化内核页表
  * 映射 IO设备、内核代码/数据段、物理内存池、以及每个进程的内核栈
  */
 void kvm_init()
 {
+    spinlock_init(&kvm_lk, "kvm");
+
     // 1. 分配根页表
     kern_pagetable = (pgtbl_t)pmem_alloc(true);
     if (!kern_pagetable) panic("kvm_init: alloc failed");
     
+    // 直接映射的区域使用 vm_mappages_huge: 地址对齐的部分用 2MB/1GB 大页, 其余用 4KB 页
+
     // 2. 映射 UART 设备 (读写)
     vm_mappages(kern_pagetable, UART_BASE, UART_BASE, PGSIZE, PTE_R | PTE_W);
 
     // 3. 映射 CLINT 中断控制器 (读写)
-    vm_mappages(kern_pagetable, CLINT_BASE, CLINT_BASE, 0x10000, PTE_R | PTE_W);
+    vm_mappages_huge(kern_pagetable, CLINT_BASE, CLINT_BASE, 0x10000, PTE_R | PTE_W);
 
     // 4. 映射 PLIC 中断控制器 (读写)
-    vm_mappages(kern_pagetable, PLIC_BASE, PLIC_BASE, 0x400000, PTE_R | PTE_W);
+    vm_mappages_huge(kern_pagetable, PLIC_BASE, PLIC_BASE, 0x400000, PTE_R | PTE_W);
     vm_mappages(kern_pagetable, VIRTIO_BASE, VIRTIO_BASE, PGSIZE, PTE_R | PTE_W);
     // 5. 映射内核代码段 (读执行 PTE_R | PTE_X)
     // 范围: KERNEL_BASE ~ KERNEL_DATA (不含)
     uint64 code_len = (uint64)KERNEL_DATA - KERNEL_BASE;
-    vm_mappages(kern_pagetable, KERNEL_BASE, KERNEL_BASE, code_len, PTE_R | PTE_X);
+    vm_mappages_huge(kern_pagetable, KERNEL_BASE, KERNEL_BASE, code_len, PTE_R | PTE_X);
 
     // 6. 映射内核数据段 (读写 PTE_R | PTE_W)
     // 范围: KERNEL_DATA ~ ALLOC_BEGIN
     uint64 data_len = (uint64)ALLOC_BEGIN - (uint64)KERNEL_DATA;
-    vm_mappages(kern_pagetable, (uint64)KERNEL_DATA, (uint64)KERNEL_DATA, data_len, PTE_R | PTE_W);
+    vm_mappages_huge(kern_pagetable, (uint64)KERNEL_DATA, (uint64)KERNEL_DATA, data_len, PTE_R | PTE_W);
 
     // 7. 映射动态内存分配区域 (读写 PTE_R | PTE_W)
-    // 范围: ALLOC_BEGIN ~ ALLOC_END
-    uint64 free_mem_len = (uint64)ALLOC_END - (uint64)ALLOC_BEGIN;
-    vm_mappages(kern_pagetable, (uint64)ALLOC_BEGIN, (uint64)ALLOC_BEGIN, free_mem_len, PTE_R | PTE_W);
+    // 范围: ALLOC_BEGIN ~ 内存结束 (除开头外基本都是2MB/1GB大页)
+    uint64 free_mem_len = boot_info.mem_end - (uint64)ALLOC_BEGIN;
+    vm_mappages_huge(kern_pagetable, (uint64)ALLOC_BEGIN, (uint64)ALLOC_BEGIN, free_mem_len, PTE_R | PTE_W);
 
     // 8. 映射 Trampoline 跳板页 (读执行 PTE_R | PTE_X)
     // 必须映射到虚拟地址的最高处 TRAMPOLINE
     extern char trampoline[];
     vm_mappages(kern_pagetable, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-    // 9. 映射所有进程的内核栈
-    for (int i = 0; i < N_PROC; i++) {
-        // 页 1
-        void *stack_p1 = pmem_alloc(false);
-        if (!stack_p1) panic("kvm_init: alloc kstack page 1 failed");
-        // 页 2
-        void *stack_p2 = pmem_alloc(false);
-        if (!stack_p2) panic("kvm_init: alloc kstack page 2 failed");
+    // 9. 进程的内核栈在创建进程控制块时由 kvm_map_kstack 按需映射
+}
 
-        uint64 kstack_va_base = KSTACK(i);
-        
-        // 映射低地址页
-        vm_mappages(kern_pagetable, kstack_va_base, (uint64)stack_p1, PGSIZE, PTE_R | PTE_W);
-        // 映射高地址页
-        vm_mappages(kern_pagetable, kstack_va_base + PGSIZE, (uint64)stack_p2, PGSIZE, PTE_R | PTE_W);
-    }
+/*
+ * 为一个新的进程控制块映射内核栈 (两个页面)
+ * 内核栈的虚拟地址只会从无效变为有效, 其他CPU第一次访问时会重新查页表
+ */
+void kvm_map_kstack(uint64 kstack)
+{
+    // 页 1
+    void *stack_p1 = pmem_alloc_flags(false, 0);
+    if (!stack_p1) panic("kvm_map_kstack: alloc kstack page 1 failed");
+    // 页 2
+    void *stack_p2 = pmem_alloc_flags(false, 0);
+    if (!stack_p2) panic("kvm_map_kstack: alloc kstack page 2 failed");
+
+    kvm_lock();
+    // 映射低地址页
+    vm_mappages(kern_pagetable, kstack, (uint64)stack_p1, PGSIZE, PTE_R | PTE_W);
+    // 映射高地址页
+    vm_mappages(kern_pagetable, kstack + PGSIZE, (uint64)stack_p2, PGSIZE, PTE_R | PTE_W);
+    kvm_unlock();
+    sfence_vma();
+}
+
+/* 修改内核页表之前/之后调用 (见 kvm_lk) */
+void kvm_lock()
+{
+    spinlock_acquire(&kvm_lk);
+}
+
+void kvm_unlock()
+{
+    spinlock_release(&kvm_lk);
 }
 
 /*
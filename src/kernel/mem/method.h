@@ -4,34 +4,131 @@
 
 void pmem_init(void);
 void *pmem_alloc(bool in_kernel);
+void *pmem_alloc_flags(bool in_kernel, uint32 flags);
 void pmem_free(uint64 page, bool in_kernel);
-void pmem_stat(uint32 *free_pages_in_kernel, uint32 *free_pages_in_user);
+void pmem_page_get(uint64 page);
+uint64 pmem_zero_page();
+void *pmem_alloc_pages(uint32 order, bool in_kernel);
+void pmem_free_pages(uint64 page, uint32 order, bool in_kernel);
+void pmem_split_pages(uint64 page, uint32 order);
+page_t *pmem_page(uint64 pa);
+void pmem_stat(uint32 *free_pages_in_kernel, uint32 *free_pages_in_user, pmem_frag_t *frag);
+void pmem_print_info();
+void pmem_zero_idle();
+void pmem_register_shrinker(shrinker_t *s);
+uint32 pmem_reclaim(bool in_kernel, uint32 target);
+void pmem_reclaim_idle();
+uint32 pmem_shortage(bool in_kernel);
+uint64 pmem_bench(uint32 rounds, bool in_kernel);
+/* kmalloc.c: 内核对象分配 (slab) */
+
+void kmem_init();
+kmem_cache_t *kmem_cache_create(char *name, uint32 size);
+void *kmem_cache_alloc(kmem_cache_t *c);
+void kmem_cache_free(kmem_cache_t *c, void *ptr);
+void *kmalloc(uint32 size);
+void kfree(void *ptr);
+void kmem_cache_print(kmem_cache_t *c);
+void kmem_print_info();
+
 /* kvm.c: 内核态虚拟内存管理 + 页表通用函数 */
 
+pte_t *__vm_getpte(pgtbl_t pgtbl, uint64 va, bool alloc, int target_level, int *level);
 pte_t *vm_getpte(pgtbl_t pgtbl, uint64 va, bool alloc);
+void __vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm, int max_level);
 void vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm);
-void vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit);
+void vm_mappages_huge(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm);
+bool vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit);
+bool vm_split_huge(pgtbl_t pgtbl, uint64 va);
+void vm_walk(pgtbl_t pgtbl, uint64 va, uint64 len, vm_walk_fn_t fn, void *arg);
+void vm_walk_swap(pgtbl_t pgtbl, uint64 va, uint64 len, vm_walk_fn_t fn, void *arg);
+uint32 vm_protect(pgtbl_t pgtbl, uint64 va, uint64 len, int clear, int set);
 void vm_print(pgtbl_t pgtbl);
 void kvm_init();
 void kvm_inithart();
+void kvm_map_kstack(uint64 kstack);
+void kvm_lock();
+void kvm_unlock();
 
 /* uvm.c: 用户态虚拟内存管理 */
 
-void uvm_copyin(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len);
-void uvm_copyout(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len);
-void uvm_copyin_str(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 maxlen);
+struct proc;  // proc/type.h
+struct inode; // fs/type.h
+
+int uvm_copyin(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len);
+int uvm_copyout(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len);
+int uvm_copyin_str(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 maxlen);
 void uvm_show_mmaplist(mmap_region_t *mmap);
-void uvm_mmap(uint64 begin, uint32 npages, int perm);
-void uvm_munmap(uint64 begin, uint32 npages);
+uint64 uvm_mmap(uint64 begin, uint32 npages, int perm, int flags, struct inode *ip, uint32 offset);
+int uvm_munmap(uint64 begin, uint32 npages);
+void uvm_msync(uint64 begin, uint32 npages);
+int uvm_madvise(uint64 begin, uint32 npages, int advice);
+void uvm_munmap_all();
 uint64 uvm_heap_grow(pgtbl_t pgtbl, uint64 cur_heap_top, uint32 len);
 uint64 uvm_heap_ungrow(pgtbl_t pgtbl, uint64 cur_heap_top, uint32 len);
 uint64 uvm_ustack_grow(pgtbl_t pgtbl, uint64 old_ustack_npage, uint64 fault_addr);
+int uvm_cow_fault(pgtbl_t pgtbl, uint64 va);
+void uvm_map_zero(pgtbl_t pgtbl, uint64 va, uint64 len, int perm);
+int uvm_lazy_fault(pgtbl_t pgtbl, uint64 heap_top, mmap_region_t *mmap_tree, uint64 va, bool write);
 void uvm_destroy_pgtbl(pgtbl_t pgtbl);
+void uvm_thp_scan();
+void uvm_thp_print_info();
 void uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint64 ustack_npage, mmap_region_t *mmap);
+void uvm_asid_init();
+bool uvm_asid_enable(bool enable);
+uint64 uvm_activate(struct proc *p, bool *flush);
+void uvm_tlb_ipi();
+void uvm_flush_tlb_proc(struct proc *p, uint64 va, uint64 len);
+void uvm_flush_tlb_kernel(uint64 va, uint64 len);
+void uvm_flush_tlb(pgtbl_t pgtbl, uint64 va, uint64 len);
+void uvm_tlb_print_info();
+
+/* swap.c: 交换区 */
+
+void swap_init();
+uint32 swap_alloc();
+void swap_dup(uint32 slot);
+void swap_free(uint32 slot);
+uint32 swap_out(uint32 nr, bool self);
+int swap_in(pgtbl_t pgtbl, uint64 va, pte_t *pte);
+void swap_balance();
+void swap_print_info();
+
+/* zram.c: 压缩交换层 */
+
+void zram_init();
+uint32 zram_store(uint64 pa);
+void zram_load(uint32 slot, uint64 pa);
+void zram_dup(uint32 slot);
+void zram_free(uint32 slot);
+void zram_print_info();
+
+/* vmalloc.c: 虚拟地址连续的内核内存 */
+
+void vmalloc_init();
+void *vmalloc(uint64 size);
+void vfree(void *addr);
+void vmalloc_print_info();
+
+/* wss.c: 工作集估计 */
+
+void wss_scan();
+void wss_print_info();
+
+/* ksm.c: 同页合并 */
+
+void ksm_init();
+void ksm_scan();
+void ksm_print_info();
 
-/* mmap.c: mmap_node仓库管理 */
+/* mmap.c: mmap_node仓库管理 + 区域索引(AVL树) */
 
 void mmap_init();
 mmap_region_t *mmap_region_alloc();
 void mmap_region_free(mmap_region_t *mmap);
 void mmap_show_nodelist();
+void mmap_tree_insert(mmap_region_t **root, mmap_region_t *node);
+void mmap_tree_remove(mmap_region_t **root, mmap_region_t *node);
+void mmap_tree_update(mmap_region_t **root, mmap_region_t *node);
+mmap_region_t *mmap_tree_lookup(mmap_region_t *root, uint64 va);
+uint64 mmap_tree_find_gap(mmap_region_t *root, uint64 len);
@@ -1,99 +1,263 @@
 #include "mod.h"
 
 /* * 管理 mmap_region 结构体的内存池
- * 我们预先分配 N_MMAP 个节点，并通过单向链表维护空闲节点
+ * mmap_region 由专用的 slab cache 分配, 数量只受物理内存限制
  */
-static mmap_region_node_t region_pool[N_MMAP];  // 静态节点池
-static mmap_region_node_t pool_sentinel;        // 链表哨兵节点（头节点）
-static spinlock_t pool_lock;                    // 保护内存池的自旋锁
+static kmem_cache_t *region_cache;
 
 // 初始化 mmap 区域分配器
 void mmap_init()
 {
-    // 初始化锁，用于保护空闲链表
-    spinlock_init(&pool_lock, "mmap_allocator");
+    region_cache = kmem_cache_create("mmap_region", sizeof(mmap_region_t));
+}
 
-    spinlock_acquire(&pool_lock);
+// 分配一个 mmap_region 结构体
+// 物理内存耗尽时由 pmem_alloc 触发 panic
+mmap_region_t *mmap_region_alloc()
+{
+    mmap_region_t *mmap = kmem_cache_alloc(region_cache);
 
-    // 将所有静态节点串联成空闲链表
-    // 哨兵节点的 next 指向数组的第一个元素
-    pool_sentinel.next = &region_pool[0];
+    // 初始化节点数据，防止脏数据残留
+    mmap->begin = 0;
+    mmap->npages = 0;
+    mmap->perm = 0;
+    mmap->flags = 0;
+    mmap->ip = NULL;
+    mmap->offset = 0;
+    mmap->advice = MADV_NORMAL;
+    mmap->next = NULL;
+    mmap->left = mmap->right = mmap->parent = NULL;
+    mmap->height = 1;
+    mmap->gap = mmap->max_gap = 0;
 
-    // 遍历数组，将当前节点的 next 指向下一个节点
-    for (int i = 0; i < N_MMAP - 1; i++) {
-        region_pool[i].next = &region_pool[i + 1];
-    }
-    
-    // 最后一个节点的 next 设为 NULL，表示链表结束
-    region_pool[N_MMAP - 1].next = NULL;
+    return mmap;
+}
 
-    spinlock_release(&pool_lock);
+// 将不再使用的 mmap_region 结构体归还给内存池 (同时放弃文件映射持有的inode)
+void mmap_region_free(mmap_region_t *mmap)
+{
+    if (mmap == NULL)
+        return;
+
+    if (mmap->ip)
+        inode_put(mmap->ip);
+
+    kmem_cache_free(region_cache, mmap);
 }
 
-// 从内存池中分配一个 mmap_region 结构体
-// 如果没有空闲节点，则触发 panic
-mmap_region_t *mmap_region_alloc()
+// 调试辅助函数：打印 mmap_region 内存池的使用情况
+void mmap_show_nodelist()
+{
+    kmem_cache_print(region_cache);
+}
+
+/*------------------------------ 区域索引 (AVL树) ------------------------------*/
+
+static int tree_height(mmap_region_t *n)
+{
+    return n ? n->height : 0;
+}
+
+static uint64 tree_max_gap(mmap_region_t *n)
+{
+    return n ? n->max_gap : 0;
+}
+
+// 根据子节点重新计算高度和子树中最大的gap
+static void tree_pull(mmap_region_t *n)
+{
+    n->height = 1 + MAX(tree_height(n->left), tree_height(n->right));
+    n->max_gap = MAX(n->gap, MAX(tree_max_gap(n->left), tree_max_gap(n->right)));
+}
+
+// 把parent指向old的指针改为指向new (parent为NULL时修改树根)
+static void tree_replace(mmap_region_t **root, mmap_region_t *parent, mmap_region_t *old, mmap_region_t *new)
+{
+    if (parent == NULL)
+        *root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+    if (new)
+        new->parent = parent;
+}
+
+static mmap_region_t *rotate_left(mmap_region_t **root, mmap_region_t *x)
 {
-    spinlock_acquire(&pool_lock);
+    mmap_region_t *y = x->right;
+    tree_replace(root, x->parent, x, y);
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    y->left = x;
+    x->parent = y;
+    tree_pull(x);
+    tree_pull(y);
+    return y;
+}
+
+static mmap_region_t *rotate_right(mmap_region_t **root, mmap_region_t *x)
+{
+    mmap_region_t *y = x->left;
+    tree_replace(root, x->parent, x, y);
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    y->right = x;
+    x->parent = y;
+    tree_pull(x);
+    tree_pull(y);
+    return y;
+}
 
-    // 从链表头获取第一个空闲节点
-    mmap_region_node_t *free_node = pool_sentinel.next;
-    
-    if (free_node == NULL) {
-        // 资源耗尽，无法恢复
-        spinlock_release(&pool_lock);
-        panic("mmap_region_alloc: run out of mmap nodes");
+// 从n开始向上直到树根: 更新高度和max_gap, 失衡时旋转
+static void tree_retrace(mmap_region_t **root, mmap_region_t *n)
+{
+    while (n != NULL) {
+        tree_pull(n);
+        int balance = tree_height(n->left) - tree_height(n->right);
+        if (balance > 1) {
+            if (tree_height(n->left->left) < tree_height(n->left->right))
+                rotate_left(root, n->left);
+            n = rotate_right(root, n);
+        } else if (balance < -1) {
+            if (tree_height(n->right->right) < tree_height(n->right->left))
+                rotate_right(root, n->right);
+            n = rotate_left(root, n);
+        }
+        n = n->parent;
     }
+}
 
-    // 将头指针移动到下一个节点，完成节点摘除
-    pool_sentinel.next = free_node->next;
+// 中序遍历的前一个/后一个节点
+static mmap_region_t *tree_prev(mmap_region_t *n)
+{
+    if (n->left) {
+        n = n->left;
+        while (n->right)
+            n = n->right;
+        return n;
+    }
+    while (n->parent && n == n->parent->left)
+        n = n->parent;
+    return n->parent;
+}
 
-    spinlock_release(&pool_lock);
+static mmap_region_t *tree_next(mmap_region_t *n)
+{
+    if (n->right) {
+        n = n->right;
+        while (n->left)
+            n = n->left;
+        return n;
+    }
+    while (n->parent && n == n->parent->right)
+        n = n->parent;
+    return n->parent;
+}
 
-    // 初始化节点数据，防止脏数据残留
-    // 注意：虽然这里返回的是 mmap_region_t 指针，但其实质是 node 的第一个成员
-    free_node->mmap.begin = 0;
-    free_node->mmap.npages = 0;
-    free_node->mmap.next = NULL;
+// 重新计算n与前一个区域之间的gap, 并更新到树根路径上的max_gap
+static void tree_set_gap(mmap_region_t **root, mmap_region_t *n)
+{
+    mmap_region_t *prev = tree_prev(n);
+    n->gap = n->begin - (prev ? REGION_END(prev) : MMAP_BEGIN);
+    tree_retrace(root, n);
+}
 
-    return &free_node->mmap;
+/* 把区域加入树中 (不能与已有的区域重叠) */
+void mmap_tree_insert(mmap_region_t **root, mmap_region_t *node)
+{
+    mmap_region_t *parent = NULL;
+    mmap_region_t **link = root;
+    while (*link) {
+        parent = *link;
+        link = (node->begin < parent->begin) ? &parent->left : &parent->right;
+    }
+
+    node->left = node->right = NULL;
+    node->parent = parent;
+    node->height = 1;
+    *link = node;
+
+    tree_set_gap(root, node);
+    mmap_region_t *next = tree_next(node);
+    if (next)
+        tree_set_gap(root, next);
 }
 
-// 将不再使用的 mmap_region 结构体归还给内存池
-void mmap_region_free(mmap_region_t *mmap)
+/* 把区域从树中摘除 */
+void mmap_tree_remove(mmap_region_t **root, mmap_region_t *node)
 {
-    if (mmap == NULL)
-        return;
+    mmap_region_t *next = tree_next(node);
+    mmap_region_t *fix;
 
-    // 强转回节点类型
-    mmap_region_node_t *node_to_free = (mmap_region_node_t *)mmap;
+    if (node->left && node->right) {
+        // 用后继(右子树中最左的节点)顶替node的位置
+        if (next->parent == node) {
+            fix = next;
+        } else {
+            fix = next->parent;
+            tree_replace(root, next->parent, next, next->right);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        tree_replace(root, node->parent, node, next);
+        next->left = node->left;
+        next->left->parent = next;
+    } else {
+        fix = node->parent;
+        tree_replace(root, node->parent, node, node->left ? node->left : node->right);
+    }
+    tree_retrace(root, fix);
 
-    spinlock_acquire(&pool_lock);
+    node->left = node->right = node->parent = NULL;
+    if (next)
+        tree_set_gap(root, next);
+}
 
-    // 头插法：将归还的节点插入到链表头部
-    node_to_free->next = pool_sentinel.next;
-    pool_sentinel.next = node_to_free;
+/* 区域的begin或npages被原地修改后调用 (与前后区域的先后顺序不能改变) */
+void mmap_tree_update(mmap_region_t **root, mmap_region_t *node)
+{
+    tree_set_gap(root, node);
+    mmap_region_t *next = tree_next(node);
+    if (next)
+        tree_set_gap(root, next);
+}
 
-    spinlock_release(&pool_lock);
+/* 返回begin不超过va的最后一个区域 (va可能在它内部也可能在它之后), 没有则返回NULL */
+mmap_region_t *mmap_tree_lookup(mmap_region_t *root, uint64 va)
+{
+    mmap_region_t *found = NULL;
+    while (root) {
+        if (root->begin <= va) {
+            found = root;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return found;
 }
 
-// 调试辅助函数：打印当前内存池中的空闲节点链表
-void mmap_show_nodelist()
+/* 在 [MMAP_BEGIN, MMAP_END) 中寻找地址最低的长度为len的空闲范围, 失败返回0 */
+uint64 mmap_tree_find_gap(mmap_region_t *root, uint64 len)
 {
-    spinlock_acquire(&pool_lock);
-
-    printf("--- MMAP Free Node List ---\n");
-    mmap_region_node_t *curr = pool_sentinel.next;
-    int count = 0;
-    
-    while (curr != NULL) {
-        // 计算当前节点在数组中的索引
-        // 利用指针减法计算偏移量
-        int index = (int)(curr - &region_pool[0]);
-        printf("Free Node #%d: Pool Index = %d, Addr = %p\n", count++, index, curr);
-        curr = curr->next;
+    // 区域之间的空隙
+    mmap_region_t *n = root;
+    while (n && n->max_gap >= len) {
+        if (tree_max_gap(n->left) >= len)
+            n = n->left;
+        else if (n->gap >= len)
+            return n->begin - n->gap;
+        else
+            n = n->right;
     }
-    printf("Total free nodes: %d\n", count);
 
-    spinlock_release(&pool_lock);
-}
\ No newline at end of file
+    // 最后一个区域之后的空间
+    mmap_region_t *last = root;
+    while (last && last->right)
+        last = last->right;
+    uint64 start = last ? REGION_END(last) : MMAP_BEGIN;
+    return (start + len <= MMAP_END) ? start : 0;
+}
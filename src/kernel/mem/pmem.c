@@ -5,107 +5,428 @@
 static alloc_region_t kernel_pool;
 static alloc_region_t user_pool;
 
+// 每个CPU在两个内存池前各有一个弹匣: [cpuid][in_kernel]
+static page_mag_t pmem_mag[NCPU][2];
+
+// 全局共享的只读零页 (来自用户池, 自己持有一个永远不释放的引用)
+static uint64 zero_page;
+
+// 所有登记的shrinker (只增不减, 遍历时不加锁)
+static shrinker_t *shrinker_list;
+static spinlock_t shrinker_lk;
+
+// 物理页描述符数组, 覆盖 [mem_map_base, mem_map_end)
+static page_t *mem_map;
+static uint64 mem_map_base;
+static uint64 mem_map_end;
+
+static bool pool_borrow(alloc_region_t *pool);
+
+/*
+ * 获取物理地址对应的页描述符
+ */
+page_t *pmem_page(uint64 pa)
+{
+    return &mem_map[(pa - mem_map_base) / PGSIZE];
+}
+
+/*--------------------------- 伙伴系统的链表操作 ---------------------------*/
+
+static void free_list_init(page_node_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void free_list_add(page_node_t *head, page_node_t *node)
+{
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+}
+
+static void free_list_del(page_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+}
+
+/*
+ * 把一个order阶的块还给伙伴系统, 并尽可能与伙伴合并
+ * 调用者需要持有pool->lk
+ */
+static void buddy_free_block(alloc_region_t *pool, uint64 pa, uint32 order)
+{
+    pool->allocable += (1u << order);
+
+    while (order < BUDDY_MAX_ORDER) {
+        uint64 buddy = pa ^ ((uint64)PGSIZE << order);
+        if (buddy < mem_map_base || buddy + ((uint64)PGSIZE << order) > mem_map_end)
+            break;
+
+        // 伙伴可能属于另一个池 (池的边界, 或者是借来/借出的块)
+        page_t *bp = pmem_page(buddy);
+        if (bp->pool != pool->id || !(bp->flags & PAGE_FREE) || bp->order != order)
+            break;
+
+        // 伙伴空闲且同阶: 摘下来合并成更高一阶
+        free_list_del((page_node_t *)buddy);
+        pool->nr_free[order]--;
+        bp->flags &= ~PAGE_FREE;
+
+        pa = MIN(pa, buddy);
+        order++;
+    }
+
+    page_t *pg = pmem_page(pa);
+    pg->flags |= PAGE_FREE;
+    pg->order = order;
+    free_list_add(&pool->free_area[order], (page_node_t *)pa);
+    pool->nr_free[order]++;
+}
+
+/*
+ * 从伙伴系统取出一个order阶的块, 没有足够大的块时返回0
+ * 调用者需要持有pool->lk
+ */
+static uint64 buddy_alloc_block(alloc_region_t *pool, uint32 order)
+{
+    uint32 cur = order;
+    while (cur <= BUDDY_MAX_ORDER && pool->nr_free[cur] == 0)
+        cur++;
+    if (cur > BUDDY_MAX_ORDER)
+        return 0;
+
+    uint64 pa = (uint64)pool->free_area[cur].next;
+    free_list_del((page_node_t *)pa);
+    pool->nr_free[cur]--;
+    pmem_page(pa)->flags &= ~PAGE_FREE;
+
+    // 块太大: 每次对半拆开, 把后一半挂回低一阶的链表
+    while (cur > order) {
+        cur--;
+        uint64 half = pa + ((uint64)PGSIZE << cur);
+        page_t *hp = pmem_page(half);
+        hp->flags |= PAGE_FREE;
+        hp->order = cur;
+        free_list_add(&pool->free_area[cur], (page_node_t *)half);
+        pool->nr_free[cur]++;
+    }
+
+    pmem_page(pa)->order = order;
+    pool->allocable -= (1u << order);
+    return pa;
+}
+
 /*
  * 内部辅助函数：初始化指定的内存池
  * pool: 目标内存池结构体
+ * id: POOL_KERNEL 或 POOL_USER
  * start: 物理内存起始地址
  * end: 物理内存结束地址
  * lock_name: 锁的名称
  */
-static void init_pool(alloc_region_t *pool, uint64 start, uint64 end, char *lock_name)
+static void init_pool(alloc_region_t *pool, uint8 id, uint64 start, uint64 end, char *lock_name)
 {
     pool->begin = start;
     pool->end = end;
+    pool->id = id;
+    pool->borrowed = 0;
+    pool->nr_borrow = pool->nr_return = 0;
     pool->allocable = 0;
-    
+    pool->nr_zeroed = 0;
+    pool->zeroed.next = NULL;
+
     // 初始化保护该池的自旋锁
     spinlock_init(&pool->lk, lock_name);
 
-    // 初始化空闲链表头（哨兵节点）
-    pool->list_head.next = NULL;
+    // 初始化每一阶的空闲链表头（哨兵节点）
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        free_list_init(&pool->free_area[i]);
+        pool->nr_free[i] = 0;
+    }
+
+    for (uint64 pa = start; pa < end; pa += PGSIZE)
+        pmem_page(pa)->pool = id;
 
-    // 将地址范围内的所有物理页加入空闲链表
-    // 按照页大小步进，将每个页面的首地址强转为 page_node_t 并插入链表
-    for (uint64 addr = start; addr < end; addr += PGSIZE) {
-        page_node_t *node = (page_node_t *)addr;
-        
-        // 头插法：将新页面插入到 list_head 之后
-        node->next = pool->list_head.next;
-        pool->list_head.next = node;
-        
-        pool->allocable++;
+    // 将地址范围切成尽可能大的对齐块加入伙伴系统
+    uint64 addr = start;
+    while (addr < end) {
+        uint32 order = BUDDY_MAX_ORDER;
+        while (order > 0 && (addr % ((uint64)PGSIZE << order) != 0 ||
+                             addr + ((uint64)PGSIZE << order) > end))
+            order--;
+        buddy_free_block(pool, addr, order);
+        addr += (uint64)PGSIZE << order;
     }
+
+    // 水位线按池的大小计算
+    pool->wmark_low = MAX(pool->allocable >> PMEM_WMARK_SHIFT, PMEM_WMARK_MIN);
+    pool->wmark_high = pool->wmark_low * 2;
 }
 
 /*
  * 物理内存初始化
- * 将 ALLOC_BEGIN 到 ALLOC_END 的物理内存划分为内核用和用户用两部分
+ * 将 ALLOC_BEGIN 到内存结束(boot_info.mem_end)的物理内存划分为 page_t数组 + 内核用 + 用户用 三部分
  */
 void pmem_init(void)
 {
     uint64 start_addr = (uint64)ALLOC_BEGIN;
-    uint64 end_addr = (uint64)ALLOC_END;
-    
+    uint64 end_addr = boot_info.mem_end;
+
     // 检查地址对齐
     if (start_addr % PGSIZE != 0 || end_addr % PGSIZE != 0) {
         panic("pmem_init: memory address not aligned");
     }
 
-    // 计算内核池的边界：起始地址 + 预留页数 * 页大小
-    uint64 kernel_pool_end = start_addr + (uint64)KERN_PAGES * PGSIZE;
-    
+    // 划出page_t数组 (它本身占据的页面也有描述符, 只是永远不会被分配)
+    uint64 npages = (end_addr - start_addr) / PGSIZE;
+    uint64 map_size = ALIGN_UP(npages * sizeof(page_t), PGSIZE);
+    mem_map = (page_t *)start_addr;
+    mem_map_base = start_addr;
+    mem_map_end = end_addr;
+    memset(mem_map, 0, map_size);
+    start_addr += map_size;
+
+    // 计算内核池的边界：起始地址 + 预留页数 * 页大小 (随内存大小按比例增加)
+    uint64 kern_pages = MAX(KERN_PAGES, npages >> KERN_POOL_SHIFT);
+    uint64 kernel_pool_end = start_addr + kern_pages * PGSIZE;
+
     if (kernel_pool_end > end_addr) {
         panic("pmem_init: not enough memory");
     }
 
     // 分别初始化两个池
-    // 内核池：ALLOC_BEGIN ~ KERNEL_POOL_END
-    init_pool(&kernel_pool, start_addr, kernel_pool_end, "kernel_pmem_lk");
-    
-    // 用户池：KERNEL_POOL_END ~ ALLOC_END
-    init_pool(&user_pool, kernel_pool_end, end_addr, "user_pmem_lk");
+    // 内核池：mem_map之后 ~ KERNEL_POOL_END
+    init_pool(&kernel_pool, POOL_KERNEL, start_addr, kernel_pool_end, "kernel_pmem_lk");
+
+    // 用户池：KERNEL_POOL_END ~ 内存结束
+    init_pool(&user_pool, POOL_USER, kernel_pool_end, end_addr, "user_pmem_lk");
+
+    spinlock_init(&shrinker_lk, "shrinker_lk");
+    for (int i = 0; i < NCPU; i++) {
+        spinlock_init(&pmem_mag[i][0].lk, "pmem_mag");
+        spinlock_init(&pmem_mag[i][1].lk, "pmem_mag");
+    }
+
+    zero_page = (uint64)pmem_alloc(false);
+}
+
+/*
+ * 内部辅助函数：弹匣为空时从伙伴系统批量取页
+ * 调用者需要关中断, 返回实际取到的页面数
+ */
+static uint32 mag_refill(page_mag_t *mag, alloc_region_t *pool)
+{
+    uint32 moved = 0;
+    uint64 pa;
+
+    spinlock_acquire(&pool->lk);
+    while (moved < PMEM_MAG_BATCH && (pa = buddy_alloc_block(pool, 0)) != 0) {
+        page_node_t *node = (page_node_t *)pa;
+        node->next = mag->list_head.next;
+        mag->list_head.next = node;
+        moved++;
+    }
+    spinlock_release(&pool->lk);
+
+    mag->count += moved;
+    return moved;
+}
+
+/*
+ * 内部辅助函数：弹匣满时把一批页面还给伙伴系统
+ * 调用者需要关中断
+ */
+static void mag_drain(page_mag_t *mag, alloc_region_t *pool, uint32 batch)
+{
+    spinlock_acquire(&pool->lk);
+    while (batch > 0 && mag->list_head.next != NULL) {
+        page_node_t *node = mag->list_head.next;
+        mag->list_head.next = node->next;
+        mag->count--;
+        batch--;
+        buddy_free_block(pool, (uint64)node, 0);
+    }
+    spinlock_release(&pool->lk);
+}
+
+/*
+ * 内部辅助函数：把所有CPU弹匣中的页面倒回伙伴系统
+ * 伙伴系统耗尽时调用, 否则其他CPU弹匣里的空闲页面对我们不可见; 返回倒回的页面数
+ */
+static uint32 mag_drain_all(alloc_region_t *pool, bool in_kernel)
+{
+    uint32 moved = 0;
+
+    for (int i = 0; i < boot_info.ncpu; i++) {
+        page_mag_t *mag = &pmem_mag[i][in_kernel];
+        if (mag->count == 0)
+            continue;
+        spinlock_acquire(&mag->lk);
+        moved += mag->count;
+        mag_drain(mag, pool, mag->count);
+        spinlock_release(&mag->lk);
+    }
+    return moved;
+}
+
+/*
+ * 内部辅助函数：从预清零链表取一个页面, 没有则返回NULL
+ * 先不加锁地看一眼数量, 避免预清零池为空时白白抢锁
+ */
+static page_node_t *zeroed_take(alloc_region_t *pool)
+{
+    page_node_t *node = NULL;
+
+    if (pool->nr_zeroed == 0)
+        return NULL;
+
+    spinlock_acquire(&pool->lk);
+    if (pool->nr_zeroed > 0) {
+        node = pool->zeroed.next;
+        pool->zeroed.next = node->next;
+        pool->nr_zeroed--;
+    }
+    spinlock_release(&pool->lk);
+
+    // 链表指针占用了页面开头, 补上这部分的清零
+    if (node)
+        node->next = NULL;
+    return node;
 }
 
 /*
  * 分配一个物理页
  * in_kernel: true 表示从内核池分配，false 表示从用户池分配
- * 返回值: 分配到的物理页的首地址（已清零）；如果耗尽则 panic
+ * flags: PMEM_ZEROED 表示需要全0的页面, 否则页面内容不确定
+ *        PMEM_NORETRY 表示分配失败时返回NULL
+ *        PMEM_MAYFAIL 表示尽力借内存和回收之后仍然失败时返回NULL
+ * 返回值: 分配到的物理页的首地址；耗尽时先向另一个池借, 再向各个缓存回收, 仍然没有才 panic
  */
-void *pmem_alloc(bool in_kernel)
+void *pmem_alloc_flags(bool in_kernel, uint32 flags)
 {
     // 根据参数选择目标内存池
     alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
-    void *ret_addr = NULL;
+    page_node_t *node;
 
-    // 获取锁，保证分配过程原子性
-    spinlock_acquire(&pool->lk);
+    // 优先使用空闲时清零好的页面
+    if ((flags & PMEM_ZEROED) && (node = zeroed_take(pool)) != NULL)
+        goto out;
 
-    // 从链表头取出一个空闲页
-    page_node_t *node = pool->list_head.next;
-    
-    if (node != NULL) {
-        // 成功获取：更新链表头指向下一个节点
-        pool->list_head.next = node->next;
-        pool->allocable--;
-        ret_addr = (void *)node;
-    } else {
-        // 内存耗尽，释放锁并 panic
-        spinlock_release(&pool->lk);
+retry:
+    // 关中断后当前CPU的弹匣只属于我们自己
+    push_off();
+    page_mag_t *mag = &pmem_mag[mycpuid()][in_kernel];
+    spinlock_acquire(&mag->lk);
+
+    // 弹匣空了才需要碰伙伴系统
+    if (mag->count == 0 && mag_refill(mag, pool) == 0) {
+        spinlock_release(&mag->lk);
+        pop_off();
+        // 其他CPU的弹匣里可能还有空闲页面
+        if (mag_drain_all(pool, in_kernel) > 0)
+            goto retry;
+        if (flags & PMEM_NORETRY)
+            return NULL;
+        // 另一个池有富余就先借一块
+        if (pool_borrow(pool))
+            goto retry;
+        // 伙伴系统耗尽时, 预清零的页面是最后的储备
+        if ((node = zeroed_take(pool)) != NULL)
+            goto out;
+        // 直接回收: 缓存吐出了页面就再试一次
+        if (pmem_reclaim(in_kernel, pool->wmark_low) > 0)
+            goto retry;
+        if (flags & PMEM_MAYFAIL)
+            return NULL;
         panic(in_kernel ? "pmem_alloc: kernel memory exhausted" : "pmem_alloc: user memory exhausted");
     }
 
-    spinlock_release(&pool->lk);
+    node = mag->list_head.next;
+    mag->list_head.next = node->next;
+    mag->count--;
+    spinlock_release(&mag->lk);
+    pop_off();
+
+    // 弹匣里的是脏页, 调用者需要全0时只能在这里清零
+    if (flags & PMEM_ZEROED)
+        memset(node, 0, PGSIZE);
+
+out:
+    // 新页面只有一个使用者
+    pmem_page((uint64)node)->ref = 1;
+    pmem_page((uint64)node)->age = 0;
+    return (void *)node;
+}
+
+/*
+ * 全局共享的零页: 还没有写过的匿名页面/BSS都映射到它 (可写的以写时复制的方式映射)
+ * 任何人都不能写入它, 它的引用数永远不会降到0
+ */
+uint64 pmem_zero_page()
+{
+    return zero_page;
+}
+
+/*
+ * 为一个物理页增加一个使用者 (写时复制共享页面)
+ * 之后每个使用者各自调用一次pmem_free
+ */
+void pmem_page_get(uint64 page)
+{
+    __sync_fetch_and_add(&pmem_page(page)->ref, 1);
+}
+
+/* 分配一个全0的物理页 */
+void *pmem_alloc(bool in_kernel)
+{
+    return pmem_alloc_flags(in_kernel, PMEM_ZEROED);
+}
+
+/*
+ * 内部辅助函数：为一个池补充预清零页面, 最多 PMEM_ZERO_BATCH 个
+ * 清零在锁外进行, 不会阻塞其他CPU的分配
+ */
+static void zeroed_refill(alloc_region_t *pool)
+{
+    for (int i = 0; i < PMEM_ZERO_BATCH; i++) {
+        spinlock_acquire(&pool->lk);
+        uint64 pa = 0;
+        if (pool->nr_zeroed < PMEM_ZERO_TARGET)
+            pa = buddy_alloc_block(pool, 0);
+        spinlock_release(&pool->lk);
 
-    // 分配出的物理页可能包含旧数据，必须清零
-    if (ret_addr) {
-        memset(ret_addr, 0, PGSIZE);
+        if (pa == 0)
+            return;
+
+        memset((void *)pa, 0, PGSIZE);
+
+        spinlock_acquire(&pool->lk);
+        page_node_t *node = (page_node_t *)pa;
+        node->next = pool->zeroed.next;
+        pool->zeroed.next = node;
+        pool->nr_zeroed++;
+        spinlock_release(&pool->lk);
     }
+}
 
-    return ret_addr;
+/*
+ * 空闲时的清零工作 (由调度器在找不到可运行进程时调用)
+ * 用户池的页面消耗更快, 先补充用户池
+ */
+void pmem_zero_idle()
+{
+    if (user_pool.nr_zeroed < PMEM_ZERO_TARGET)
+        zeroed_refill(&user_pool);
+    if (kernel_pool.nr_zeroed < PMEM_ZERO_TARGET)
+        zeroed_refill(&kernel_pool);
 }
 
 /*
- * 释放一个物理页
+ * 释放一个物理页 (丢弃一个使用者, 最后一个使用者释放时才真正回收)
  * page: 物理页地址
  * in_kernel: 归还到哪个池
  */
@@ -117,38 +438,371 @@ void pmem_free(uint64 page, bool in_kernel)
     if (page % PGSIZE != 0) {
         panic("pmem_free: address not page aligned");
     }
-    
-    if (page < pool->begin || page >= pool->end) {
-        panic("pmem_free: address out of range");
+
+    if (page < mem_map_base || page >= mem_map_end || pmem_page(page)->pool != pool->id) {
+        panic("pmem_free: page not in this pool");
     }
 
-    spinlock_acquire(&pool->lk);
+    // 引用数原来就是0: 重复释放 (不检查的话会回绕成0xFFFFFFFF, 页面悄悄泄漏)
+    uint32 old = __sync_fetch_and_sub(&pmem_page(page)->ref, 1);
+    if (old == 0)
+        panic("pmem_free: double free");
+    // 页面仍被其他页表共享
+    if (old > 1)
+        return;
+
+    push_off();
+    page_mag_t *mag = &pmem_mag[mycpuid()][in_kernel];
+    spinlock_acquire(&mag->lk);
+
+    // 弹匣满了就先还一批给伙伴系统
+    if (mag->count >= PMEM_MAG_SIZE)
+        mag_drain(mag, pool, PMEM_MAG_BATCH);
 
-    // 将物理页转换回节点结构，插入到链表头部
+    // 将物理页转换回节点结构，插入到弹匣头部
     page_node_t *node = (page_node_t *)page;
-    node->next = pool->list_head.next;
-    pool->list_head.next = node;
-    pool->allocable++;
+    node->next = mag->list_head.next;
+    mag->list_head.next = node;
+    mag->count++;
+
+    spinlock_release(&mag->lk);
+    pop_off();
+}
+
+/*
+ * 分配 2^order 个物理地址连续的页面 (首地址按 PGSIZE << order 对齐, 已清零)
+ * order == 0 等价于 pmem_alloc
+ * 没有足够大的连续块时返回 NULL, 调用者可以退回到逐页分配
+ */
+void *pmem_alloc_pages(uint32 order, bool in_kernel)
+{
+    if (order == 0)
+        return pmem_alloc(in_kernel);
+    if (order > BUDDY_MAX_ORDER)
+        return NULL;
+
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
 
+    spinlock_acquire(&pool->lk);
+    uint64 pa = buddy_alloc_block(pool, order);
     spinlock_release(&pool->lk);
+
+    if (pa == 0)
+        return NULL;
+
+    memset((void *)pa, 0, PGSIZE << order);
+    pmem_page(pa)->ref = 1;
+    pmem_page(pa)->age = 0;
+    return (void *)pa;
+}
+
+/*
+ * 释放 pmem_alloc_pages 分配的连续页面
+ * order 必须与分配时一致, 释放时会与空闲的伙伴合并
+ */
+void pmem_free_pages(uint64 page, uint32 order, bool in_kernel)
+{
+    if (order == 0) {
+        pmem_free(page, in_kernel);
+        return;
+    }
+
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
+
+    if (order > BUDDY_MAX_ORDER || page % ((uint64)PGSIZE << order) != 0)
+        panic("pmem_free_pages: bad order or alignment");
+    if (page < mem_map_base || page + ((uint64)PGSIZE << order) > mem_map_end ||
+        pmem_page(page)->pool != pool->id)
+        panic("pmem_free_pages: page not in this pool");
+
+    page_t *pg = pmem_page(page);
+    if ((pg->flags & PAGE_FREE) || pg->order != order)
+        panic("pmem_free_pages: order mismatch or double free");
+
+    spinlock_acquire(&pool->lk);
+    buddy_free_block(pool, page, order);
+    spinlock_release(&pool->lk);
+}
+
+/*
+ * 把 pmem_alloc_pages 分配的一个 order 阶的块拆成 2^order 个独立的页面
+ * 每个页面继承块的引用数, 之后可以分别共享和用 pmem_free 释放 (拆分用户大页时使用)
+ */
+void pmem_split_pages(uint64 page, uint32 order)
+{
+    page_t *pg = pmem_page(page);
+    if ((pg->flags & PAGE_FREE) || pg->order != order)
+        panic("pmem_split_pages: order mismatch");
+
+    uint32 ref = pg->ref;
+    for (uint32 i = 0; i < (1u << order); i++) {
+        page_t *sub = pmem_page(page + (uint64)i * PGSIZE);
+        sub->order = 0;
+        sub->ref = ref;
+        sub->age = pg->age;
+    }
+}
+
+/*
+ * 统计某个内存池的空闲页面数 (伙伴系统 + 预清零页面 + 所有CPU的弹匣)
+ * 弹匣的count不加锁读取, 得到的是一个近似值
+ * nr_free非空时顺便拷贝每一阶的空闲块数量 (弹匣和预清零的页面计入0阶)
+ */
+static uint32 pool_free_pages(alloc_region_t *pool, bool in_kernel, uint32 *nr_free)
+{
+    uint32 total, cached = 0;
+
+    for (int i = 0; i < boot_info.ncpu; i++)
+        cached += pmem_mag[i][in_kernel].count;
+
+    spinlock_acquire(&pool->lk);
+    cached += pool->nr_zeroed;
+    total = pool->allocable;
+    if (nr_free) {
+        for (int i = 0; i <= BUDDY_MAX_ORDER; i++)
+            nr_free[i] = pool->nr_free[i];
+        nr_free[0] += cached;
+    }
+    spinlock_release(&pool->lk);
+
+    return total + cached;
+}
+
+/*------------------------------ 池之间的借用 ------------------------------*/
+
+static alloc_region_t *other_pool(alloc_region_t *pool)
+{
+    return pool == &kernel_pool ? &user_pool : &kernel_pool;
+}
+
+// 辅助：修改一个块中所有页面的归属 (块已经从原来的伙伴系统摘下, 还没有挂到新的里)
+static void set_owner(uint64 pa, uint32 order, uint8 id)
+{
+    for (uint32 i = 0; i < (1u << order); i++)
+        pmem_page(pa + (uint64)i * PGSIZE)->pool = id;
+    __sync_synchronize();
+}
+
+/*
+ * 从另一个池借一个POOL_LEND_ORDER阶的空闲块给pool
+ * 对方借出后的空闲页面不能低于它的wmark_high; 成功返回true
+ */
+static bool pool_borrow(alloc_region_t *pool)
+{
+    alloc_region_t *lender = other_pool(pool);
+    uint32 chunk = 1u << POOL_LEND_ORDER;
+
+    if (pool_free_pages(lender, lender == &kernel_pool, NULL) < lender->wmark_high + chunk)
+        return false;
+
+    // 借出的块原本就在pool的范围内时, 相当于对方把之前借的还了回来
+    spinlock_acquire(&lender->lk);
+    uint64 pa = buddy_alloc_block(lender, POOL_LEND_ORDER);
+    bool home = pa >= pool->begin && pa < pool->end;
+    if (pa != 0 && home)
+        lender->borrowed -= MIN(lender->borrowed, chunk);
+    spinlock_release(&lender->lk);
+    if (pa == 0)
+        return false;
+
+    set_owner(pa, POOL_LEND_ORDER, pool->id);
+    spinlock_acquire(&pool->lk);
+    buddy_free_block(pool, pa, POOL_LEND_ORDER);
+    if (!home)
+        pool->borrowed += chunk;
+    pool->nr_borrow++;
+    spinlock_release(&pool->lk);
+    return true;
+}
+
+/*
+ * 把pool借来的内存还回去一块: 找一个完整落在对方原有范围内且不小于POOL_LEND_ORDER阶的空闲块
+ * 空闲页面比wmark_high多出一块以上才还; 成功返回true
+ */
+static bool pool_return(alloc_region_t *pool)
+{
+    alloc_region_t *home = other_pool(pool);
+    uint32 chunk = 1u << POOL_LEND_ORDER;
+
+    if (pool->borrowed == 0 || pool_free_pages(pool, pool == &kernel_pool, NULL) < pool->wmark_high + chunk)
+        return false;
+
+    uint64 pa = 0;
+    uint32 order = 0;
+    spinlock_acquire(&pool->lk);
+    for (uint32 o = POOL_LEND_ORDER; o <= BUDDY_MAX_ORDER && pa == 0; o++) {
+        for (page_node_t *n = pool->free_area[o].next; n != &pool->free_area[o]; n = n->next) {
+            if ((uint64)n >= home->begin && (uint64)n + ((uint64)PGSIZE << o) <= home->end) {
+                pa = (uint64)n;
+                order = o;
+                break;
+            }
+        }
+    }
+    if (pa != 0) {
+        free_list_del((page_node_t *)pa);
+        pool->nr_free[order]--;
+        pool->allocable -= 1u << order;
+        pmem_page(pa)->flags &= ~PAGE_FREE;
+        pool->borrowed -= MIN(pool->borrowed, 1u << order);
+        pool->nr_return++;
+    }
+    spinlock_release(&pool->lk);
+    if (pa == 0)
+        return false;
+
+    set_owner(pa, order, home->id);
+    spinlock_acquire(&home->lk);
+    buddy_free_block(home, pa, order);
+    spinlock_release(&home->lk);
+    return true;
+}
+
+/*------------------------------ 内存回收 ------------------------------*/
+
+/* 登记一个shrinker (s由调用者提供, 登记后不能释放) */
+void pmem_register_shrinker(shrinker_t *s)
+{
+    spinlock_acquire(&shrinker_lk);
+    s->next = shrinker_list;
+    // 先填好next再发布, 遍历链表的一方不加锁
+    __sync_synchronize();
+    shrinker_list = s;
+    spinlock_release(&shrinker_lk);
+}
+
+/*
+ * 依次调用属于该池的shrinker, 直到池的空闲页面达到target或者一整轮都回收不出东西
+ * 返回回收的对象总数 (0表示没有任何进展)
+ * 回收的对象不一定马上变成空闲页面(比如slab中的对象), 所以用空闲页面数判断是否结束
+ */
+uint32 pmem_reclaim(bool in_kernel, uint32 target)
+{
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
+    uint32 total = 0, progress;
+
+    do {
+        progress = 0;
+        for (shrinker_t *s = shrinker_list; s != NULL; s = s->next) {
+            if (s->in_kernel != in_kernel || s->count() == 0)
+                continue;
+            progress += s->scan(PMEM_RECLAIM_BATCH);
+            if (pool_free_pages(pool, in_kernel, NULL) >= target)
+                return total + progress;
+        }
+        total += progress;
+    } while (progress > 0);
+
+    return total;
+}
+
+/*
+ * 后台回收 (由调度器在找不到可运行进程时调用)
+ * 空闲页面低于wmark_low时先向另一个池借, 借不到再回收到wmark_high, 让分配路径尽量不用直接回收
+ * 最后把用不上的借来的内存还回去
+ */
+void pmem_reclaim_idle()
+{
+    if (pool_free_pages(&user_pool, false, NULL) < user_pool.wmark_low && !pool_borrow(&user_pool))
+        pmem_reclaim(false, user_pool.wmark_high);
+    if (pool_free_pages(&kernel_pool, true, NULL) < kernel_pool.wmark_low && !pool_borrow(&kernel_pool))
+        pmem_reclaim(true, kernel_pool.wmark_high);
+
+    // 借来的内存用不上了就还回去
+    pool_return(&user_pool);
+    pool_return(&kernel_pool);
+}
+
+/*
+ * 换出页面之前调用 (见 swap.c): 空闲页面低于wmark_low时先向另一个池借, 借不到再用shrinker回收缓存
+ * 返回距离wmark_high还差多少个页面, 0表示不缺
+ */
+uint32 pmem_shortage(bool in_kernel)
+{
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
+
+    uint32 free = pool_free_pages(pool, in_kernel, NULL);
+    if (free >= pool->wmark_low)
+        return 0;
+    // 空闲页面里有一部分停在各个CPU的弹匣中, 先倒回伙伴系统让缺页的CPU拿得到
+    mag_drain_all(pool, in_kernel);
+    if (pool_borrow(pool))
+        return 0;
+    pmem_reclaim(in_kernel, pool->wmark_high);
+    free = pool_free_pages(pool, in_kernel, NULL);
+    return free >= pool->wmark_high ? 0 : pool->wmark_high - free;
 }
 
 /*
  * [修复] 获取物理内存统计信息
- * 必须与 method.h 中的声明一致: void pmem_stat(uint32*, uint32*)
+ * frag 非空时同时输出两个池每一阶的空闲块数量 (碎片化报告)
  */
-void pmem_stat(uint32 *free_pages_in_kernel, uint32 *free_pages_in_user) {
+void pmem_stat(uint32 *free_pages_in_kernel, uint32 *free_pages_in_user, pmem_frag_t *frag)
+{
+    uint32 kernel_free = pool_free_pages(&kernel_pool, true, frag ? frag->kernel_free_blocks : NULL);
+    uint32 user_free = pool_free_pages(&user_pool, false, frag ? frag->user_free_blocks : NULL);
+
     // 获取内核池统计
-    if (free_pages_in_kernel) {
-        spinlock_acquire(&kernel_pool.lk);
-        *free_pages_in_kernel = kernel_pool.allocable;
-        spinlock_release(&kernel_pool.lk);
-    }
-    
+    if (free_pages_in_kernel)
+        *free_pages_in_kernel = kernel_free;
+
     // 获取用户池统计
-    if (free_pages_in_user) {
-        spinlock_acquire(&user_pool.lk);
-        *free_pages_in_user = user_pool.allocable;
-        spinlock_release(&user_pool.lk);
+    if (free_pages_in_user)
+        *free_pages_in_user = user_free;
+}
+
+/* 输出一个池的碎片化信息: 每一阶的空闲块数, 以及无法满足2MB连续分配的空闲页占比 */
+static void print_frag(char *name, uint32 free_pages, uint32 *nr_free)
+{
+    uint32 huge_pages = 0;
+    for (int i = 9; i <= BUDDY_MAX_ORDER; i++)
+        huge_pages += nr_free[i] << i;
+
+    printf("%s: free pages = %d\n", name, free_pages);
+    printf("order: ");
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++)
+        printf("%d:%d ", i, nr_free[i]);
+    printf("\n");
+    if (free_pages)
+        printf("unusable for order-9: %d%%\n", (free_pages - huge_pages) * 100 / free_pages);
+}
+
+/* 输出物理内存的碎片化报告 (for debug) */
+void pmem_print_info()
+{
+    pmem_frag_t frag;
+    uint32 kernel_free, user_free;
+
+    pmem_stat(&kernel_free, &user_free, &frag);
+    print_frag("kernel pool", kernel_free, frag.kernel_free_blocks);
+    print_frag("user pool", user_free, frag.user_free_blocks);
+    printf("zeroed pages: kernel = %d, user = %d\n", kernel_pool.nr_zeroed, user_pool.nr_zeroed);
+    printf("watermark: kernel = %d/%d, user = %d/%d\n", kernel_pool.wmark_low, kernel_pool.wmark_high,
+        user_pool.wmark_low, user_pool.wmark_high);
+    printf("borrowed: kernel = %d pages (%d borrows, %d returns), user = %d pages (%d borrows, %d returns)\n",
+        kernel_pool.borrowed, kernel_pool.nr_borrow, kernel_pool.nr_return,
+        user_pool.borrowed, user_pool.nr_borrow, user_pool.nr_return);
+}
+
+/*
+ * 分配器吞吐量测试 (供 sys_pmem_bench 使用)
+ * 每一轮先连续申请 PMEM_BENCH_BATCH 个页面再全部释放
+ * 返回消耗的时钟周期数 (time CSR)
+ * 在多个CPU上同时运行, 可以观察每个CPU的吞吐量是否随 -smp 线性扩展
+ */
+#define PMEM_BENCH_BATCH 16
+
+uint64 pmem_bench(uint32 rounds, bool in_kernel)
+{
+    void *pages[PMEM_BENCH_BATCH];
+    uint64 begin = r_time();
+
+    for (uint32 r = 0; r < rounds; r++) {
+        for (int i = 0; i < PMEM_BENCH_BATCH; i++)
+            pages[i] = pmem_alloc(in_kernel);
+        for (int i = 0; i < PMEM_BENCH_BATCH; i++)
+            pmem_free((uint64)pages[i], in_kernel);
     }
-}
\ No newline at end of file
+
+    return r_time() - begin;
+}
@@ -0,0 +1,345 @@
+#include "mod.h"
+#include "../fs/mod.h"
+#include "../proc/mod.h"
+
+/*
+ * 交换区: 把进程独占的匿名页面写到磁盘上, 缺页时再读回来 (设计见 type.h)
+ * 交换区直接用块号读写磁盘, 不经过块缓冲区 (换出的页面本身就是DMA的缓冲区)
+ * 换出的页面先交给zram压缩存放, zram不要的才写磁盘; 槽位号的最高位区分两者
+ */
+
+extern super_block_t sb;
+
+static spinlock_t swap_lk;   // 保护下面的槽位引用数和分配游标
+static uint16 *swap_map;     // 每个槽位的引用数, 0表示空闲
+static uint32 swap_nr;       // 槽位数量 (0表示没有交换区)
+static uint32 swap_first;    // 交换区的起始块号
+static uint32 swap_cursor;   // 下一次从这里开始找空闲槽位
+static uint32 swap_used;     // 已经使用的槽位数量
+
+// 时钟指针: 同一时间只有一个CPU在换出页面 (swap_busy), 由它独占
+static int swap_busy;
+static proc_t *clock_proc;   // NULL 表示从进程链表的开头重新开始
+static uint64 clock_va = USER_BASE;
+
+// 统计信息
+static uint32 swap_outs;
+static uint32 swap_cold_outs; // 其中按工作集扫描的age选出的冷页面
+static uint32 swap_ins;
+static uint32 swap_disk_ins; // 从磁盘读回的页面 (zram没有命中)
+static uint32 swap_aborts;   // 写盘期间页面被修改而放弃的换出
+
+static shrinker_t swap_shrinker;
+
+// 辅助：读写一个槽位 (pa 是一个完整的物理页)
+static void swap_rw(uint32 slot, uint64 pa, bool write)
+{
+    buffer_t b;
+    memset(&b, 0, sizeof(b));
+    b.block_num = swap_first + slot;
+    b.data = (uint8 *)pa;
+    virtio_disk_rw(&b, write);
+}
+
+// 在文件系统初始化之后调用 (需要超级块)
+void swap_init()
+{
+    spinlock_init(&swap_lk, "swap");
+    zram_init();
+    pmem_register_shrinker(&swap_shrinker);
+    swap_first = sb.swap_firstblock;
+    swap_nr = sb.swap_blocks;
+    if (swap_nr == 0) {
+        printf("swap: disabled\n");
+        return;
+    }
+
+    swap_map = (uint16 *)vmalloc(swap_nr * sizeof(uint16));
+    if (swap_map == NULL)
+        panic("swap_init: no memory");
+    printf("swap: %d slots at block %d\n", swap_nr, swap_first);
+}
+
+// 分配一个槽位 (引用数为1), 交换区满了返回SWAP_NONE
+uint32 swap_alloc()
+{
+    uint32 slot = SWAP_NONE;
+
+    spinlock_acquire(&swap_lk);
+    for (uint32 i = 0; i < swap_nr; i++) {
+        uint32 s = (swap_cursor + i) % swap_nr;
+        if (swap_map[s] == 0) {
+            swap_map[s] = 1;
+            swap_cursor = s + 1;
+            swap_used++;
+            slot = s;
+            break;
+        }
+    }
+    spinlock_release(&swap_lk);
+    return slot;
+}
+
+// fork 时父子进程共享交换项
+void swap_dup(uint32 slot)
+{
+    if (SLOT_IS_ZRAM(slot)) {
+        zram_dup(slot);
+        return;
+    }
+    spinlock_acquire(&swap_lk);
+    if (slot >= swap_nr || swap_map[slot] == 0)
+        panic("swap_dup: bad slot");
+    if (swap_map[slot] == 0xFFFF)
+        panic("swap_dup: too many references");
+    swap_map[slot]++;
+    spinlock_release(&swap_lk);
+}
+
+// 释放一个交换项, 引用数归零时槽位变为空闲
+void swap_free(uint32 slot)
+{
+    if (SLOT_IS_ZRAM(slot)) {
+        zram_free(slot);
+        return;
+    }
+    spinlock_acquire(&swap_lk);
+    if (slot >= swap_nr || swap_map[slot] == 0)
+        panic("swap_free: bad slot");
+    if (--swap_map[slot] == 0)
+        swap_used--;
+    spinlock_release(&swap_lk);
+}
+
+/*
+ * 可以扫描和修改页表的进程 (调用者持有q->lk, 它在此期间不会被唤醒或调度)
+ * 在用户态被抢占的进程和睡眠的进程都停在没有进行到一半的页表操作的地方:
+ * 页表操作中途只会在换出页面时睡眠, 而同一时间只有一个CPU在换出 (swap_busy)
+ * 当前进程只有 self 为true (缺页处理的开头等安全点) 时可以,
+ * 从分配路径进入回收时它可能正拿着某个页表项 (fork/写时复制进行到一半)
+ */
+static bool swappable(proc_t *q, bool self)
+{
+    if (q->pgtbl == NULL)
+        return false;
+    if (q == myproc())
+        return self;
+    return (q->state == RUNNABLE && q->user_preempted) || q->state == SLEEPING;
+}
+
+// 时钟扫描一个进程时选出的页面
+typedef struct swap_scan {
+    uint8 min_age;           // 只选择age不小于它的页面 (见 wss.c)
+    uint32 n;
+    uint64 va[SWAP_BATCH];
+    uint64 pa[SWAP_BATCH];
+    uint64 next;             // 选满时下一个没有扫描的地址 (0表示扫完了整个地址空间)
+} swap_scan_t;
+
+// 辅助：时钟算法检查一个页面
+static void scan_one(pte_t *pte, uint64 va, int level, void *arg)
+{
+    swap_scan_t *s = (swap_scan_t *)arg;
+
+    if (s->n == SWAP_BATCH) {
+        if (s->next == 0)
+            s->next = va;
+        return;
+    }
+    if (level != 0 || !(*pte & PTE_U))
+        return;
+    uint64 pa = PTE_TO_PA(*pte);
+    if (pa == pmem_zero_page() || pmem_page(pa)->ref != 1)
+        return;
+
+    if (*pte & PTE_A) {
+        *pte &= ~PTE_A;
+        pmem_page(pa)->age = 0;
+        return;
+    }
+    if (pmem_page(pa)->age < s->min_age)
+        return;
+    // 写盘前清除脏位, 写完后据此判断页面有没有被改过
+    *pte &= ~PTE_D;
+    pmem_page_get(pa);
+    s->va[s->n] = va;
+    s->pa[s->n] = pa;
+    s->n++;
+}
+
+/*
+ * 辅助：把选出的页面压缩到zram或者写到交换区, 然后换成交换项
+ * 压缩和写盘期间没有持有q->lk: 之后重新确认进程和页面都没有变化
+ * 调用者给页面加了一个引用, 这里释放; 换出成功返回1
+ */
+static uint32 swap_out_page(proc_t *q, int pid, uint64 va, uint64 pa, bool self)
+{
+    uint32 ok = 0;
+    uint32 slot = zram_store(pa);
+    if (slot == SWAP_NONE) {
+        slot = swap_alloc();
+        if (slot != SWAP_NONE)
+            swap_rw(slot, pa, true);
+    }
+
+    if (slot != SWAP_NONE) {
+        spinlock_acquire(&q->lk);
+        int lv = -1;
+        pte_t *pte = NULL;
+        if (q->pid == pid && swappable(q, self))
+            pte = __vm_getpte(q->pgtbl, va, false, 0, &lv);
+        if (pte != NULL && lv == 0 && (*pte & (PTE_V | PTE_D)) == PTE_V &&
+            PTE_TO_PA(*pte) == pa && pmem_page(pa)->ref == 2) {
+            *pte = SWAP_PTE(slot, *pte);
+            uvm_flush_tlb_proc(q, va, PGSIZE);
+            pmem_free(pa, false); // 页表的引用
+            ok = 1;
+        }
+        spinlock_release(&q->lk);
+
+        if (!ok) {
+            swap_free(slot);
+            swap_aborts++;
+        }
+    }
+
+    pmem_free(pa, false); // 我们的引用
+    return ok;
+}
+
+/*
+ * 辅助：时钟指针走最多SWAP_SCAN_STEPS步, 换出最多 nr 个age不小于 min_age 的页面
+ * 每一步扫描时钟指针指向的进程, 从clock_va开始最多选出SWAP_BATCH个页面
+ * 调用者占有swap_busy, 返回实际换出的数量
+ */
+static uint32 clock_steps(uint32 nr, uint8 min_age, bool self)
+{
+    uint32 done = 0;
+    for (int step = 0; step < SWAP_SCAN_STEPS && done < nr; step++) {
+        proc_t *q = clock_proc != NULL ? clock_proc : proc_first();
+        if (q == NULL)
+            break;
+
+        swap_scan_t s;
+        s.min_age = min_age;
+        s.n = 0;
+        s.next = 0;
+
+        spinlock_acquire(&q->lk);
+        int pid = q->pid;
+        if (swappable(q, self) && clock_va < TRAPFRAME) {
+            vm_walk(q->pgtbl, clock_va, TRAPFRAME - clock_va, scan_one, &s);
+            // 让其他CPU上残留的(脏位为1的)TLB表项失效, 之后的写入才会重新设置 PTE_D
+            if (s.n > 0)
+                uvm_flush_tlb_proc(q, s.va[0], s.va[s.n - 1] + PGSIZE - s.va[0]);
+        }
+        spinlock_release(&q->lk);
+
+        // 推进时钟指针: 这个进程扫完了就换下一个
+        if (s.next != 0) {
+            clock_va = s.next;
+        } else {
+            clock_proc = q->next;
+            clock_va = USER_BASE;
+        }
+
+        for (uint32 i = 0; i < s.n; i++)
+            done += swap_out_page(q, pid, s.va[i], s.pa[i], self);
+    }
+    return done;
+}
+
+/*
+ * 用时钟算法换出最多 nr 个页面, 返回实际换出的数量
+ * 先只换出工作集扫描认为冷的页面, 不够时再换出最近一次检查以来没有访问过的页面
+ * 已经有CPU在换出时直接返回0 (它换出的页面大家都能用)
+ * self: 是否也可以换出当前进程的页面 (见 swappable)
+ */
+uint32 swap_out(uint32 nr, bool self)
+{
+    if (__sync_lock_test_and_set(&swap_busy, 1) != 0)
+        return 0;
+
+    uint32 done = clock_steps(nr, WSS_COLD_AGE, self);
+    swap_cold_outs += done;
+    if (done < nr)
+        done += clock_steps(nr - done, 0, self);
+    swap_outs += done;
+
+    __sync_lock_release(&swap_busy);
+    return done;
+}
+
+/*
+ * 缺页时把交换项 pte 对应的页面读回来 (从磁盘读时会睡眠)
+ * pgtbl 是当前进程的页表, 读盘期间只有当前进程自己会修改它
+ * 成功返回0, 回收之后仍然没有内存返回-1 (交换项保持不变)
+ */
+int swap_in(pgtbl_t pgtbl, uint64 va, pte_t *pte)
+{
+    pte_t old = *pte;
+    uint32 slot = PTE_TO_SLOT(old);
+
+    void *mem = pmem_alloc_flags(false, PMEM_MAYFAIL);
+    if (mem == NULL)
+        return -1;
+    if (SLOT_IS_ZRAM(slot)) {
+        zram_load(slot, (uint64)mem);
+    } else {
+        swap_rw(slot, (uint64)mem, false);
+        swap_disk_ins++;
+    }
+
+    if (*pte != old) {
+        pmem_free((uint64)mem, false);
+        return 0;
+    }
+    *pte = PA_TO_PTE(mem) | (old & (PTE_R | PTE_W | PTE_X | PTE_U | PTE_COW)) | PTE_V | PTE_A;
+    swap_free(slot);
+    uvm_flush_tlb(pgtbl, ALIGN_DOWN(va, PGSIZE), PGSIZE);
+    swap_ins++;
+    return 0;
+}
+
+/* 缺页处理开始时调用: 用户池的内存不够时先回收缓存, 仍然不够再换出页面 (包括当前进程的) */
+void swap_balance()
+{
+    uint32 need = pmem_shortage(false);
+    if (need)
+        swap_out(need, true);
+}
+
+/*
+ * shrinker: 系统调用中的分配(写时复制/fork/exec/换入)耗尽用户池时也能换出其他进程的页面
+ * 换出可能写盘而睡眠, 调用者持有锁(关着中断或持有睡眠锁)时跳过
+ */
+static bool swap_shrink_ok()
+{
+    proc_t *p = myproc();
+    return !swap_busy && intr_get() && p != NULL && p->nsleeplock == 0;
+}
+
+static uint32 swap_shrink_count()
+{
+    return swap_shrink_ok() ? SWAP_BATCH : 0;
+}
+
+static uint32 swap_shrink(uint32 nr)
+{
+    return swap_shrink_ok() ? swap_out(nr, false) : 0;
+}
+
+static shrinker_t swap_shrinker = {
+    .name = "swap",
+    .in_kernel = false,
+    .count = swap_shrink_count,
+    .scan = swap_shrink,
+};
+
+/* 输出交换区的统计 (for debug) */
+void swap_print_info()
+{
+    printf("swap: used = %d/%d, outs = %d (cold = %d), ins = %d (from disk = %d), aborts = %d\n",
+           swap_used, swap_nr, swap_outs, swap_cold_outs, swap_ins, swap_disk_ins, swap_aborts);
+    zram_print_info();
+}
@@ -4,38 +4,219 @@
 /*---------------------------------- 关于物理内存 ---------------------------------------*/
 
 /*
-    物理内存管理的核心是空闲页面组成的单链表:
-    kern_reagion和user_region的list_head字段是链表的头节点
-    物理页的分配就是将list_head->next移出链表
-    物理页的回收就是将node插入list_head->next
-    你可能注意到了:我们没有一个和物理页数量一样多的page_node数组
-    那是因为:当page位于空闲页链表时, 它最前面的64bit会被特别设置为next指针, 当它被分配出去后则作为普通的空间
+    物理内存管理的核心是伙伴系统(buddy system):
+    - 2^order个地址连续且按(PGSIZE << order)对齐的物理页构成一个order阶的块
+    - 每个alloc_region为每一阶维护一条空闲块组成的双向循环链表, 链头在free_area[order]
+    - 分配order阶的块: 从不小于order的最小非空链表取出一块, 多余的部分逐级对半拆开挂回低阶链表
+    - 回收order阶的块: 只要它的伙伴(地址 ^ (PGSIZE << order))也空闲且同阶, 就合并成更高一阶
+    空闲块的链表节点仍然放在块的第一个页面里(最前面的16字节)
+    判断伙伴是否空闲需要额外信息, 所以每个物理页都有一个page_t描述符, 它们组成的数组
+    放在可分配区域的开头, 由pmem_init从ALLOC_BEGIN处划出来
 */
 
 // 物理页是最基本的资源单位, 大小设置为4KB
 #define PGSIZE 4096
 
-// 物理页节点
+// 伙伴系统的最高阶: 2^10个页面 = 4MB (2MB的大页需要9阶)
+#define BUDDY_MAX_ORDER 10
+
+// 物理页节点 (位于空闲块的第一个页面)
 typedef struct page_node
 {
     struct page_node *next;
+    struct page_node *prev;
 } page_node_t;
 
+// page_t的flags字段
+#define PAGE_FREE  (1 << 0) // 该页是伙伴系统中一个空闲块的首页 (order字段有效)
+#define PAGE_SLAB  (1 << 1) // 该页是slab分配器的一个slab
+#define PAGE_LARGE (1 << 2) // 该页是kmalloc直接从伙伴系统分配的大对象的首页 (order字段有效)
+
+// page_t的pool字段
+#define POOL_NONE   0 // 不可分配 (page_t数组本身)
+#define POOL_KERNEL 1
+#define POOL_USER   2
+
+// 物理页描述符
+typedef struct page
+{
+    uint8 flags;  // PAGE_*
+    uint8 order;  // 首页: 所在块的阶 (空闲块和pmem_alloc_pages分配出去的块都会记录)
+    uint8 pool;   // 当前属于哪个池 (POOL_*, 借给另一个池之后随之改变)
+    uint8 age;    // 用户页面连续多少轮工作集扫描没有被访问 (见wss.c)
+    uint32 ref;   // 已分配页面的使用者数量 (写时复制共享的用户页面会大于1)
+} page_t;
+
 // 许多物理页构成一个可分配的区域
 typedef struct alloc_region
 {
     uint64 begin;          // 起始物理地址
     uint64 end;            // 终止物理地址
-    spinlock_t lk;         // 自旋锁(保护下面两个变量)
-    uint32 allocable;      // 可分配页面数
-    page_node_t list_head; // 可分配链的链头节点
+    spinlock_t lk;         // 自旋锁(保护下面的变量)
+    uint32 allocable;      // 可分配页面数 (各阶空闲块的页面总和)
+    uint32 nr_free[BUDDY_MAX_ORDER + 1];           // 每一阶的空闲块数量
+    page_node_t free_area[BUDDY_MAX_ORDER + 1];    // 每一阶空闲块链表的链头节点
+    uint32 nr_zeroed;      // 预清零页面的数量
+    page_node_t zeroed;    // 预清零页面单链表的链头节点 (只使用next)
+    uint32 wmark_low;      // 空闲页面低于它时开始回收 (初始化后只读)
+    uint32 wmark_high;     // 回收的目标
+    uint8 id;              // POOL_KERNEL 或 POOL_USER
+    uint32 borrowed;       // 从另一个池借来还没有还的页面数
+    uint32 nr_borrow;      // 借入的次数 (统计)
+    uint32 nr_return;      // 归还的次数 (统计)
 } alloc_region_t;
 
+// 碎片化报告 (pmem_stat输出)
+typedef struct pmem_frag
+{
+    uint32 kernel_free_blocks[BUDDY_MAX_ORDER + 1]; // 内核池每一阶的空闲块数量
+    uint32 user_free_blocks[BUDDY_MAX_ORDER + 1];   // 用户池每一阶的空闲块数量
+} pmem_frag_t;
+
+/*
+    每个CPU在每个alloc_region前面放一个页面弹匣(magazine):
+    - 弹匣是CPU私有的空闲页链表, 在关中断的情况下访问; 它的锁平时只有所属的CPU获取(没有竞争)
+    - 伙伴系统耗尽时, 分配者持有各个弹匣的锁把其他CPU弹匣里的页面倒回伙伴系统, 再决定借内存/回收/换出
+    - 弹匣为空时, 持有region->lk一次性从伙伴系统取出PMEM_MAG_BATCH个0阶块
+    - 弹匣满了时, 持有region->lk一次性把PMEM_MAG_BATCH个页面还给伙伴系统
+    - 弹匣只缓存单个页面(0阶), 弹匣里的页面在伙伴系统看来是已分配的, 不参与合并
+    这样绝大多数的pmem_alloc/pmem_free都不会碰到共享的锁和链表头
+*/
+
+#define PMEM_MAG_SIZE  64 // 单个弹匣最多缓存的页面数
+#define PMEM_MAG_BATCH 32 // 与全局链表批量交换的页面数
+
+typedef struct page_mag
+{
+    spinlock_t lk;         // 保护下面两个字段 (加锁顺序: mag->lk -> region->lk)
+    uint32 count;          // 弹匣中的页面数
+    page_node_t list_head; // 弹匣中空闲页单链表的链头节点 (只使用next)
+} page_mag_t;
+
+/*
+    预清零页面池:
+    - 每个alloc_region额外维护一条已经清零的页面链表, 由region->lk保护
+    - CPU空闲时(调度器一轮找不到RUNNABLE进程), pmem_zero_idle从伙伴系统取出页面
+      在锁外清零, 再挂到预清零链表上, 直到数量达到PMEM_ZERO_TARGET
+    - pmem_alloc_flags带PMEM_ZEROED时优先取预清零页面, 取不到才在分配路径上清零
+    - 不关心内容的调用者(马上会被完整覆盖的页面)不带PMEM_ZEROED, 直接拿弹匣里的脏页
+    - 释放的页面一律回到弹匣(脏页), 释放路径上不做清零
+*/
+
+#define PMEM_ZERO_TARGET 64 // 每个池预清零页面的目标数量
+#define PMEM_ZERO_BATCH  8  // 每次空闲时最多清零的页面数
+
+// pmem_alloc_flags的flags
+#define PMEM_ZEROED  (1 << 0) // 需要全0的页面
+#define PMEM_NORETRY (1 << 1) // 伙伴系统耗尽时直接返回NULL (不回收, 不动用预清零的储备, 不panic)
+#define PMEM_MAYFAIL (1 << 2) // 借内存和回收之后仍然没有页面时返回NULL而不是panic
+
+/*
+    内存回收:
+    - 缓存(buffer cache/inode cache等)在初始化时用pmem_register_shrinker登记一个shrinker
+      count返回当前可以回收的对象数, scan尝试回收至多nr个对象并返回实际回收的数量
+    - 每个池有两条水位线(由池的大小算出): 空闲页面少于wmark_low时开始回收, 回收到wmark_high为止
+    - 直接回收: pmem_alloc_flags发现池已耗尽时先调用shrinker, 仍然拿不到页面才panic
+    - 后台回收: 调度器空闲时检查水位, 低于wmark_low就回收到wmark_high
+    这样缓存可以放心地占用所有空闲内存, 需要时再吐出来
+    shrinker可能在持有任意锁(关中断)的分配路径上被调用, 不能睡眠也不能分配内存
+    它自己的锁已被当前CPU持有时(分配来自它自己的临界区)应当直接返回0
+    (换出页面的shrinker是例外: 它自己确认调用者没有持有任何锁才会睡眠, 见 swap.c)
+*/
+
+/*
+    池之间的借用:
+    - 内核池和用户池的大小在启动时按KERN_PAGES和内存大小划分, 之后一个池不够用时可以整块地向另一个池借内存
+      每次借一个POOL_LEND_ORDER阶的空闲块, 块中每个页面的page_t.pool改为借入的池,
+      然后挂到借入方的伙伴系统里 (伙伴合并也要求同属一个池, 所以借来的块不会和对方的块合并)
+    - 借出方借出之后空闲页面不能低于它的wmark_high, 否则不借
+    - 借入的时机: 分配时池耗尽(在直接回收之前), 以及空闲页面低于wmark_low时(后台回收和换出之前)
+    - 归还: 调度器空闲时, 借入方的空闲页面比wmark_high多出一块以上就把位于对方原有范围内的
+      完整空闲块还回去
+*/
+#define POOL_LEND_ORDER 8 // 每次借用 256 个页面 (1MB)
+
+#define PMEM_WMARK_SHIFT  6  // wmark_low = 池的页面数 / 2^PMEM_WMARK_SHIFT
+#define PMEM_WMARK_MIN    16 // wmark_low的下限
+#define PMEM_RECLAIM_BATCH 32 // 每次调用scan时请求回收的对象数
+
+typedef struct shrinker
+{
+    char *name;                 // 名字 (for debug)
+    bool in_kernel;             // 回收的页面属于哪个池
+    uint32 (*count)(void);      // 可以回收的对象数 (近似值)
+    uint32 (*scan)(uint32 nr);  // 回收至多nr个对象, 返回实际回收的数量
+    struct shrinker *next;      // 所有shrinker组成的链表 (只增不减)
+} shrinker_t;
+
+/*---------------------------------- 关于内核对象 ---------------------------------------*/
+
+/*
+    内核对象(进程控制块/trapframe/inode/file/mmap_region等)由slab分配器管理:
+    - 每种对象有一个kmem_cache, 它管理若干个slab
+    - 一个slab就是一个内核池的物理页, 开头是slab_t, 后面是等大的对象
+      对象地址向下对齐到PGSIZE就能找到它所在的slab
+    - 每个CPU在每个kmem_cache前有一个私有的对象链表(类似物理页的弹匣), 关中断访问, 不需要锁
+      私有链表空了/满了才持有cache->lk与slab批量交换对象
+    - slab不够用时从伙伴系统申请新页面, slab中的对象全部空闲且cache还有富余时把页面还回去
+    kmalloc/kfree是通用接口: 不超过KMALLOC_MAX_SIZE的请求按2的幂取整后交给对应的kmem_cache
+    更大的请求直接从伙伴系统分配连续页面
+*/
+
+#define KMEM_CPU_LIMIT 16 // 每个CPU私有链表中最多缓存的对象数
+#define KMEM_CPU_BATCH 8  // 私有链表与slab批量交换的对象数
+
+#define KMALLOC_MIN_SHIFT 4  // kmalloc最小的大小类别: 16B
+#define KMALLOC_MAX_SHIFT 11 // kmalloc最大的大小类别: 2KB
+#define KMALLOC_MAX_SIZE  (1 << KMALLOC_MAX_SHIFT)
+#define KMALLOC_NR_CLASS  (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// 空闲对象 (链表指针放在对象的开头)
+typedef struct kmem_obj
+{
+    struct kmem_obj *next;
+} kmem_obj_t;
+
+// slab描述符 (位于slab页面的开头)
+typedef struct slab
+{
+    struct kmem_cache *cache; // 所属的cache
+    struct slab *next;        // 所在链表 (partial或full)
+    struct slab *prev;
+    kmem_obj_t *free;         // 空闲对象链表
+    uint32 inuse;             // 已分配出去的对象数 (包括CPU私有链表中的对象)
+} slab_t;
+
+// CPU私有的对象链表
+typedef struct kmem_cpu
+{
+    uint32 count;     // 链表中的对象数
+    kmem_obj_t *head; // 空闲对象单链表
+} kmem_cpu_t;
+
+// 对象缓存
+typedef struct kmem_cache
+{
+    char *name;               // 名字 (for debug)
+    uint32 obj_size;          // 对象大小 (8字节对齐)
+    uint32 obj_offset;        // 第一个对象在slab中的偏移
+    uint32 objs_per_slab;     // 每个slab容纳的对象数
+    spinlock_t lk;            // 自旋锁(保护下面4个字段和所有slab)
+    slab_t partial;           // 还有空闲对象的slab链表的哨兵
+    slab_t full;              // 对象全部分配出去的slab链表的哨兵
+    uint32 nr_slabs;          // slab数量
+    uint32 nr_free;           // slab中的空闲对象数 (不含CPU私有链表)
+    kmem_cpu_t cpu[NCPU];     // 每个CPU私有的对象链表
+    struct kmem_cache *next;  // 所有kmem_cache组成的链表 (for debug)
+} kmem_cache_t;
+
 /*
     物理内存的布局情况:
     KERNEL_BASE ~ KERNEL_DATA  内核程序kernel-qemu.elf的代码区域 (不可分配回收)
     KERNEL_DATA ~ ALLOC_BEGIN  内核程序kernel-qemu.elf的数据区域 (不可分配回收)
-    ALLOC_BEGIN ~ ALLOC_END    可分配回收的区域 (前KERN_PAGES属于内核空间, 后面属于用户空间)
+    ALLOC_BEGIN ~ 内存结束     可分配回收的区域
+                               (最前面是page_t数组, 接着kern_pages属于内核空间, 后面属于用户空间)
+    内存结束的地址启动时从设备树读出 (boot_info.mem_end), kernel.ld 的 ALLOC_END 只是没有设备树时的默认值
 */
 
 // 内核基地址
@@ -46,8 +227,9 @@ extern char KERNEL_DATA[];
 extern char ALLOC_BEGIN[];
 extern char ALLOC_END[];
 
-// 可分配回收的区域中内核持有前KERN_PAGES个页面
+// 可分配回收的区域中内核持有前 kern_pages = MAX(KERN_PAGES, 总页数 >> KERN_POOL_SHIFT) 个页面
 #define KERN_PAGES 1024
+#define KERN_POOL_SHIFT 4
 
 /*---------------------------------- 关于虚拟内存 ---------------------------------------*/
 
@@ -58,10 +240,11 @@ extern char ALLOC_END[];
     
     satp寄存器的bit结构: MODE(4bit) + ASID(16bit) + PPN(44bit)
     - MODE控制虚拟内存模式
-    - ASID与Flash刷新有关
+    - ASID(地址空间标识)标记TLB表项属于哪个页表, 切换到不同ASID的页表时不必刷新整个TLB
     - PPN存放页表基地址
     可以通过w_satp(MAKE_SATP(pgtbl))命令将页表地址填入satp寄存器并启动地址翻译
     在无页表到有页表 + 切换页表的情况下会用到
+    内核页表使用ASID 0, 用户页表使用MAKE_SATP_ASID带上进程的ASID (见uvm_activate)
 
     2. SV39的虚拟地址与三级映射表
 
@@ -84,6 +267,8 @@ extern char ALLOC_END[];
     - X W R : execute write read (全0意味着这是页表所在的物理页)
     - U : 用户态是否可以访问
     - PPN区域 : 存放物理页号
+    叶子页表项也可以出现在次级页表(2MB megapage)和顶级页表(1GB gigapage)中, 此时PPN必须按大页大小对齐
+    内核的直接映射区域在对齐允许时使用大页, 以减少页表页的数量和TLB压力
 
 */
 
@@ -91,14 +276,43 @@ extern char ALLOC_END[];
 typedef uint64 pte_t;
 typedef pte_t* pgtbl_t;
 
+// vm_walk 对区间中每个有效的叶子页表项调用的函数 (level为叶子所在的级别, 0表示4KB页面)
+typedef void (*vm_walk_fn_t)(pte_t *pte, uint64 va, int level, void *arg);
+
 // satp寄存器相关
 #define SATP_SV39 (8L << 60)                                           // MODE = SV39
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12)) // 设置MODE和PPN字段
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFul
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT)) // 同时设置ASID字段
+
+/*
+    跨CPU的TLB刷新 (shootdown):
+    - 修改页表后, 本CPU直接用sfence.vma刷新, 其他在cpu_mask中的CPU通过IPI通知
+    - 每个CPU有一个邮箱, 发送方占用邮箱后填好(asid, va, len), 写CLINT的msip引发目标CPU的
+      M-mode软件中断, M-mode再把它转成S-mode软件中断, 目标CPU刷新完后清除pending
+    - 一次页表操作只发一次IPI, 范围超过TLB_FLUSH_MAX_PAGES个页面时整体刷新ASID
+    - 发送方等待期间(以及所有自旋等锁的地方)会处理发给自己的请求, 两个CPU互相发送也不会死锁
+*/
+
+#define TLB_FLUSH_MAX_PAGES 64
+
+typedef struct tlb_mailbox
+{
+    int busy;                // 被某个发送方占用 (原子操作)
+    volatile int pending;    // 有未处理的请求, 目标CPU处理完后清0
+    uint32 asid;
+    uint64 va;
+    uint64 len;
+} tlb_mailbox_t;
 
 // 获取虚拟地址中的虚拟页(VPN)信息 占9bit
 #define VA_SHIFT(level) (12 + 9 * (level))
 #define VA_TO_VPN(va, level) ((((uint64)(va)) >> VA_SHIFT(level)) & 0x1FF)
 
+// 第level级页表中一个叶子页表项映射的大小: 4KB 2MB(megapage) 1GB(gigapage)
+#define LEVEL_SIZE(level) (1ul << VA_SHIFT(level))
+
 // PA和PTE之间的转换
 #define PA_TO_PTE(pa)  ((((uint64)(pa)) >> 12) << 10)
 #define PTE_TO_PA(pte) (((uint64)(pte) >> 10) << 12)
@@ -112,6 +326,8 @@ typedef pte_t* pgtbl_t;
 #define PTE_G (1 << 5) // global
 #define PTE_A (1 << 6) // accessed
 #define PTE_D (1 << 7) // dirty
+#define PTE_COW (1 << 8) // RSW: 写时复制页面 (原本可写, 现在与其他进程共享且只读)
+#define PTE_SWAP (1 << 9) // RSW: 无效的页表项记录了换出到交换区的页面 (见 swap.c)
 
 // 检查一个PTE是否属于pgtbl
 #define PTE_CHECK(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) == 0)
@@ -127,30 +343,224 @@ typedef pte_t* pgtbl_t;
 
 // S-mode <-> U-mode 切换过程用到的临时数据区域 (用户页表)
 #define TRAPFRAME      (TRAMPOLINE - PGSIZE)
+// 每个trapframe独占一个物理页, 用户页表在TRAPFRAME处映射整页 (没有PTE_U)
 
-// 各个进程的内核空间函数栈 (内核页表)
+// 各个进程的内核空间函数栈 (内核页表, 创建进程控制块时按需映射)
 #define KSTACK(procid) (TRAPFRAME - ((procid) + 1) * 2 * PGSIZE)
 
 // 用户空间基地址 (用户页表)
 #define USER_BASE      (PGSIZE)
 
-/* mmap_region 描述了一个 mmap区域 */
+/*
+    vmalloc区域 (内核页表):
+    - [VMALLOC_BASE, VMALLOC_END) 中的虚拟地址按需分配, 把不连续的物理页映射成连续的一段
+    - 每段后面留一个不映射的保护页, 越界访问会触发内核缺页而不是踩到下一段
+    - vfree先解除映射, 刷新所有CPU的TLB之后才释放物理页
+*/
+#define VMALLOC_BASE  (1ul << 36)
+#define VMALLOC_END   (VMALLOC_BASE + (1ul << 30)) // 1GB 虚拟地址空间
+
+// vmalloc分配出去的一段
+typedef struct vm_area
+{
+    uint64 addr;          // 起始虚拟地址
+    uint32 npages;        // 映射的页面数 (不含保护页)
+    uint64 *pages;        // 各个页面的物理地址
+    struct vm_area *next; // 按地址排序的链表
+} vm_area_t;
+
+/*
+    交换区(swap):
+    - 磁盘上文件系统数据区之后的 swap_blocks 个块是交换区, 每个块(槽位)存放一个换出的页面
+    - 换出页面的页表项变成交换项: PTE_V = 0, PTE_SWAP = 1, PPN的位置记录槽位号,
+      权限位保持不变, 换入时原样恢复
+    - 每个槽位有一个引用数 (fork之后父子进程共享交换项), 归零时释放
+    - 只换出进程独占的匿名4KB页面 (引用数为1: 不是零页/块缓冲区的页面, 也不是大页)
+    - 时钟算法选择换出的页面: 时钟指针依次扫过各个进程的地址空间,
+      PTE_A 为1的页面清除 PTE_A 再给一次机会 (不刷新TLB, 只是近似), PTE_A 为0的页面换出
+      先走一遍只换出工作集扫描认为冷(age不小于WSS_COLD_AGE)的页面, 不够时再放宽
+    - 没有进程级的页表锁, 所以只扫描当前进程(在缺页处理的开头)、在用户态被抢占的进程和睡眠的进程,
+      它们都不会有进行到一半的页表操作 (页表操作中途只会在换出时睡眠, 而换出同一时间只有一个CPU在做);
+      扫描和修改其他进程的页表项时持有它的p->lk
+    - 写盘期间进程可能继续运行: 写盘前清除 PTE_D, 写完后确认页面没有再被写过
+      (PTE_D 仍为0, 映射和引用数都没变) 才换成交换项, 否则放弃这次换出
+      内核通过直接映射写用户页面(uvm_copyout)时也会设置 PTE_D
+    - 缺页处理开始时用户池的空闲页面低于 wmark_low 就先回收缓存, 仍然不够再换出页面
+    - 换出也登记为用户池的shrinker: 系统调用中的分配耗尽用户池时换出其他进程的页面
+      (它会睡眠, 所以调用者持有锁时跳过; 换入的分配也可以失败, 而不是panic)
+    - 换出的页面优先压缩存放在内存里 (zram, 见下), 只有压缩不了或者zram满了才写磁盘
+*/
+#define SWAP_BATCH      16          // 每扫描一个进程最多选出的页面数
+#define SWAP_SCAN_STEPS 64          // 一次换出最多扫描多少个进程
+#define SWAP_NONE       0xFFFFFFFF  // 交换区已满
+
+/*
+    压缩交换层(zram): 换出的页面先尝试用LZ4压缩后放在内存里, 放不下才写到磁盘
+    - 压缩存储从用户池要页面 (最多ZRAM_MAX_PAGES个), 每个页面只存放一个大小类别的对象,
+      类别按ZRAM_CLASS_STEP字节递增, 页面开头是zpage_t, 后面是等大的对象 (类似slab)
+    - 压缩后超过ZRAM_MAX_OBJ的页面不值得压缩, 直接写磁盘
+    - 交换项的槽位号最高位为1时表示zram对象, 低31位是对象物理地址右移3位 (不需要额外的索引表)
+      对象开头是zobj_t, 记录压缩后的长度和引用数 (fork之后共享)
+    - 换入时直接解压到新页面, 不需要睡眠
+*/
+#define ZRAM_MAX_PAGES  4096        // 压缩存储最多占用的页面数 (16MB)
+#define ZRAM_CLASS_STEP 128
+#define ZRAM_MAX_OBJ    3072        // 对象(含zobj_t)的最大长度
+#define ZRAM_NR_CLASS   (ZRAM_MAX_OBJ / ZRAM_CLASS_STEP)
+
+#define ZRAM_SLOT_FLAG     (1u << 31)
+#define SLOT_IS_ZRAM(slot) (((slot) & ZRAM_SLOT_FLAG) != 0)
+#define ZRAM_SLOT(obj)     (ZRAM_SLOT_FLAG | (uint32)((uint64)(obj) >> 3))
+#define ZRAM_OBJ(slot)     ((zobj_t *)((uint64)((slot) & ~ZRAM_SLOT_FLAG) << 3))
+
+// 一个压缩后的页面 (后面紧跟压缩数据)
+typedef struct zobj
+{
+    uint16 len;  // 压缩数据的长度
+    uint16 ref;  // 引用它的交换项数量
+    uint32 pad;
+} zobj_t;
+
+// 空闲对象 (链表指针放在对象的开头)
+typedef struct zfree
+{
+    struct zfree *next;
+} zfree_t;
+
+// 压缩存储的一个页面 (位于页面的开头)
+typedef struct zpage
+{
+    struct zpage *next;  // 同一类别中还有空闲对象的页面链表
+    struct zpage *prev;
+    zfree_t *free;       // 空闲对象链表
+    uint16 cls;          // 大小类别
+    uint16 inuse;        // 已经分配的对象数
+} zpage_t;
+
+#define PTE_IS_SWAP(pte) (((pte) & (PTE_V | PTE_SWAP)) == PTE_SWAP)
+#define PTE_TO_SLOT(pte) ((uint32)((uint64)(pte) >> 10))
+#define SWAP_PTE(slot, pte) (((uint64)(slot) << 10) | ((pte) & (PTE_R | PTE_W | PTE_X | PTE_U | PTE_COW)) | PTE_SWAP)
+
+/*
+    同页合并(KSM):
+    - 时钟中断时每隔KSM_SCAN_TICKS个节拍扫描当前进程的KSM_SCAN_PAGES个页面 (p->ksm_va记录扫描位置)
+      候选页面: 进程独占(引用数为1)的4KB用户页面, 不包括零页和文件映射 (块缓冲区的页面引用数总是大于1)
+    - 稳定表: 已经合并的页面, 按内容的哈希值分桶; 表本身持有页面的一个引用,
+      所以映射它的页表项都是只读的 (原来可写的加上PTE_COW), 写入时一定会复制出去
+      引用数只剩表自己时说明没有人用它了, 查找时顺便释放
+    - 不稳定表: 见过但还没有合并的页面, 只记录(进程, 虚拟地址, 物理地址, 哈希值), 不持有引用
+      使用之前持有对方的p->lk重新确认映射没有变化并逐字节比较内容, 每KSM_UNSTABLE_ROUNDS次扫描整个清空
+    - 和交换区一样没有进程级的页表锁, 只修改当前进程和在用户态被抢占的进程的页表项
+*/
+#define KSM_SCAN_TICKS      10
+#define KSM_SCAN_PAGES      16     // 每次扫描最多检查的页面数
+#define KSM_HASH_SIZE       256    // 稳定表和不稳定表的桶数
+#define KSM_UNSTABLE_MAX    1024   // 不稳定表最多记录的页面数
+#define KSM_UNSTABLE_ROUNDS 64
+
+// 稳定表和不稳定表的表项
+typedef struct ksm_node
+{
+    uint64 hash;            // 页面内容的哈希值
+    uint64 pa;              // 物理页
+    struct proc *proc;      // 不稳定表: 映射它的进程和虚拟地址
+    int pid;
+    uint64 va;
+    struct ksm_node *next;  // 同一个桶中的下一个表项
+} ksm_node_t;
+
+/*
+    工作集估计:
+    - 时钟中断时每隔WSS_SCAN_TICKS个节拍扫描当前进程的WSS_SCAN_PAGES个叶子页表项 (p->wss_va记录扫描位置)
+    - PTE_A为1时清除它并把页面的age归0, 否则age加1 (page_t.age, 最大WSS_AGE_MAX)
+      所以age是页面连续多少轮扫描没有被访问; 共享的页面只有一个age, 任何一个进程访问都会让它归0
+    - 扫描时按age累计直方图 (p->wss_acc), 扫完整个地址空间后成为 p->wss_hist
+      桶的区间是 0, 1, 2-3, 4-7, 8-15, 16+ (WSS_NR_BUCKETS 见 proc/type.h), 大页按4KB页面计数
+    - 交换区优先换出age不小于WSS_COLD_AGE的页面, 不够时才换出其他最近没有访问过的页面
+*/
+#define WSS_SCAN_TICKS  10
+#define WSS_SCAN_PAGES  64     // 每次扫描最多检查的叶子页表项数
+#define WSS_AGE_MAX     255
+#define WSS_COLD_AGE    4
+
+/*
+    透明大页(THP):
+    - 匿名内存(堆和匿名mmap区域)中按2MB对齐且完整落在同一个区域里的范围可以用一个2MB的叶子映射
+    - 写缺页时如果范围内还没有任何映射(没有最后一级页表), 直接从伙伴系统分配一个THP_ORDER阶的块
+      (读缺页只映射共享零页, 不为稀疏读取分配2MB)
+      分配不到连续内存就退回4KB页面
+    - 大页只属于一个进程: fork时先拆成4KB页面再写时复制共享
+      munmap/madvise/堆收缩/权限修改只覆盖大页的一部分时也先拆开 (vm_split_huge)
+    - 后台合并: 时钟中断时每隔THP_SCAN_TICKS个节拍扫描一次当前进程, 把页面基本齐全且没有被共享的
+      2MB范围复制到一个新的块里换成大页映射, 每次最多合并THP_SCAN_MAX个
+*/
+#define THP_ORDER 9                     // 2MB = 2^9个页面
+#define THP_SIZE  (PGSIZE << THP_ORDER)
+#define THP_SCAN_TICKS    10
+#define THP_SCAN_MAX      1
+#define THP_MAX_PTES_NONE 64            // 合并时最多允许多少个页面还没有分配(或者是零页)
+
+/*
+    mmap区域分为匿名映射和文件映射(MAP_FILE):
+    - 匿名映射的页面在第一次访问时分配全0的物理页
+    - 文件映射的页面直接使用块缓冲区的物理页(BLOCK_SIZE == PGSIZE), 不经过read()的拷贝
+      映射期间物理页的引用数大于1, 块缓冲区不会回收或者复用这个物理页
+    - 私有的文件映射(默认)以写时复制的方式映射, 写入不会影响文件
+    - 共享的文件映射(MAP_SHARED)直接映射可写的缓冲区页面, 在munmap/msync时把脏页写回磁盘
+*/
+
+// sys_mmap的flags
+#define MAP_SHARED (1 << 0) // 共享映射: 对文件映射的写入会写回文件 (匿名映射忽略)
+#define MAP_FILE   (1 << 1) // 文件映射: 第5/6个参数是文件描述符和文件偏移(PGSIZE对齐)
+#define MAP_POPULATE (1 << 2) // 建立映射时就分配/读入所有页面, 之后访问不再缺页
+
+/*
+    madvise的访问模式提示 (记录在区域的advice字段, 影响文件映射缺页时的预读窗口):
+    - MADV_NORMAL: 缺页时连同后面几个页面一起映射 (MMAP_READAHEAD_NORMAL)
+    - MADV_RANDOM: 只映射缺页的那一个页面
+    - MADV_SEQUENTIAL: 缺页时预读更大的窗口 (MMAP_READAHEAD_SEQ)
+    一次性的操作 (不记录在区域里):
+    - MADV_WILLNEED: 马上分配/读入范围内的所有页面
+    - MADV_DONTNEED: 释放范围内的所有页面 (共享文件映射先写回), 之后访问重新缺页
+*/
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+#define MMAP_READAHEAD_NORMAL 4  // 默认的预读窗口 (页面数, 包括缺页的页面)
+#define MMAP_READAHEAD_SEQ    16 // 顺序访问的预读窗口
+
+/*
+    每个进程的mmap区域同时组织成两种结构:
+    - 按地址递增的单链表 (遍历: fork复制/进程退出/打印)
+    - 以begin为键的AVL树 (查找: 缺页处理/munmap/寻找空闲地址)
+    树节点额外记录 gap = 自己的begin - 前一个区域的终点(没有前一个区域时为MMAP_BEGIN)
+    以及子树中最大的gap, 这样寻找足够大的空闲地址范围也只需要O(log n)
+*/
+
+/* mmap_region 描述了一个 mmap区域 (由slab分配) */
 typedef struct mmap_region
 {
     uint64 begin;             // 起始地址
     uint32 npages;            // 管理的页面数量
+    int perm;                 // 页面权限 (页面在第一次访问时才分配, 缺页处理需要知道权限)
+    int flags;                // MAP_SHARED / MAP_FILE
+    struct inode *ip;         // 文件映射的inode (持有一个引用), 匿名映射为NULL
+    uint32 offset;            // 文件映射中begin对应的文件偏移
+    int advice;               // MADV_NORMAL / MADV_RANDOM / MADV_SEQUENTIAL
     struct mmap_region *next; // 链表指针
-} mmap_region_t;
 
-/* mmap_region_node 是 mmap_region 在仓库里的包装 */
-typedef struct mmap_region_node
-{
-    mmap_region_t mmap;
-    struct mmap_region_node *next;
-} mmap_region_node_t;
+    struct mmap_region *left;   // AVL树
+    struct mmap_region *right;
+    struct mmap_region *parent;
+    int height;                 // 子树高度
+    uint64 gap;                 // 与前一个区域之间的空闲字节数
+    uint64 max_gap;             // 子树中最大的gap
+} mmap_region_t;
 
-/* 最大支持256个mmap_region_node */
-#define N_MMAP 256
+#define REGION_END(m) ((m)->begin + (uint64)(m)->npages * PGSIZE)
 
 // 映射区域的终点 (给ustack留16MB内存空间)
 #define MMAP_END (TRAPFRAME - 16 * 256 * PGSIZE)
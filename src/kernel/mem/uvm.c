@@ -2,7 +2,51 @@
 
 /* -------------------------------------------------------------------------
  * Part 1: 用户空间与内核空间的数据传输
- * ------------------------------------------------------------------------- */
+ * -------------------------------------------------------------------------
+ * 内核运行在自己的页表上, 用户地址在内核里没有映射, 所以不能设置sstatus.SUM直接访问
+ * 这里每个用户页面只查一次页表, 得到物理页后通过内核的直接映射整段拷贝
+ * 用户给出的地址无效(没有映射/权限不够)时返回-1, 由系统调用把错误交给用户, 而不是panic
+ */
+
+/*
+ * 辅助：获取用户地址 va 所在页面的物理地址, need 是访问需要的权限(PTE_R或PTE_W)
+ * 当前进程的堆/mmap 页面可能还没有分配, 此时先按需分配; 写入写时复制页面前先完成复制
+ * 按需分配可能睡眠(读文件/换入), 所以只在调用者没有持有任何锁时进行, 否则当作地址无效
+ * (持有文件系统或控制台锁的调用者要先把数据拷贝到内核缓冲区, 放锁后再拷贝给用户)
+ * va 落在大页中时返回它所在的4KB页面的物理地址
+ * 地址无效返回0
+ */
+static uint64 user_page(pgtbl_t user_tbl, uint64 va, int need)
+{
+    if (va >= VA_MAX)
+        return 0;
+
+    int lv = 0;
+    pte_t *pte = __vm_getpte(user_tbl, va, false, 0, &lv);
+    proc_t *p = myproc();
+
+    // 开着中断说明没有持有自旋锁
+    if ((pte == NULL || !(*pte & PTE_V)) && p != NULL && p->pgtbl == user_tbl &&
+        intr_get() && p->nsleeplock == 0) {
+        if (uvm_lazy_fault(user_tbl, p->heap_top, p->mmap_tree, va, need == PTE_W) == 0)
+            pte = __vm_getpte(user_tbl, va, false, 0, &lv);
+    }
+    if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_U))
+        return 0;
+
+    if (need == PTE_W && (*pte & PTE_COW)) {
+        if (uvm_cow_fault(user_tbl, va) < 0)
+            return 0;
+    }
+    if (!(*pte & need))
+        return 0;
+
+    // 通过直接映射写入不会经过硬件设置脏位, 这里代为设置 (换出时靠它判断页面有没有被改过)
+    if (need == PTE_W)
+        *pte |= PTE_A | PTE_D;
+
+    return PTE_TO_PA(*pte) + (ALIGN_DOWN(va, PGSIZE) & (LEVEL_SIZE(lv) - 1));
+}
 
 /*
  * 从用户空间拷贝数据到内核空间 (copy_from_user)
@@ -10,8 +54,9 @@
  * dst: 内核目的地址
  * src: 用户源地址 (虚拟地址)
  * len: 拷贝长度
+ * 成功返回0, 用户地址无效返回-1
  */
-void uvm_copyin(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
+int uvm_copyin(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
 {
     uint64 copied_bytes = 0;
     
@@ -19,26 +64,17 @@ void uvm_copyin(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
         uint64 va = src + copied_bytes;
         uint64 page_offset = va % PGSIZE;
         
-        // 查找用户地址对应的 PTE
-        pte_t *pte = vm_getpte(user_tbl, va, false);
-        
-        // 权限检查：必须有效(V)、可读(R)、用户可访问(U)
-        if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_R) || !(*pte & PTE_U)) {
-            panic("uvm_copyin: access violation or unmapped addr");
-        }
-        
-        uint64 pa = PTE_TO_PA(*pte);
-        uint64 bytes_this_page = PGSIZE - page_offset;
-        uint64 remaining = len - copied_bytes;
+        uint64 pa = user_page(user_tbl, va, PTE_R);
+        if (pa == 0)
+            return -1;
         
         // 本次拷贝取“页剩余空间”和“总剩余长度”的较小值
-        uint64 n = (bytes_this_page < remaining) ? bytes_this_page : remaining;
-        
-        // 执行拷贝
+        uint64 n = MIN(PGSIZE - page_offset, len - copied_bytes);
         memmove((void *)(dst + copied_bytes), (void *)(pa + page_offset), n);
         
         copied_bytes += n;
     }
+    return 0;
 }
 
 /*
@@ -47,8 +83,9 @@ void uvm_copyin(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
  * dst: 用户目的地址 (虚拟地址)
  * src: 内核源地址
  * len: 拷贝长度
+ * 成功返回0, 用户地址无效返回-1
  */
-void uvm_copyout(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
+int uvm_copyout(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
 {
     uint64 copied_bytes = 0;
     
@@ -56,67 +93,81 @@ void uvm_copyout(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
         uint64 va = dst + copied_bytes;
         uint64 page_offset = va % PGSIZE;
         
-        pte_t *pte = vm_getpte(user_tbl, va, false);
-        
-        // 权限检查：必须有效(V)、可写(W)、用户可访问(U)
-        if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_W) || !(*pte & PTE_U)) {
-            panic("uvm_copyout: access violation or unmapped addr");
-        }
-        
-        uint64 pa = PTE_TO_PA(*pte);
-        uint64 bytes_this_page = PGSIZE - page_offset;
-        uint64 remaining = len - copied_bytes;
-        
-        uint64 n = (bytes_this_page < remaining) ? bytes_this_page : remaining;
+        uint64 pa = user_page(user_tbl, va, PTE_W);
+        if (pa == 0)
+            return -1;
         
+        uint64 n = MIN(PGSIZE - page_offset, len - copied_bytes);
         memmove((void *)(pa + page_offset), (void *)(src + copied_bytes), n);
         
         copied_bytes += n;
     }
+    return 0;
+}
+
+// 辅助：在 [s, s + n) 中寻找 '\0', 返回它的下标, 找不到返回 n
+// 对齐之后每次检查8个字节
+static uint64 find_nul(const char *s, uint64 n)
+{
+    uint64 i = 0;
+    while (i < n && ((uint64)(s + i) & 7)) {
+        if (s[i] == '\0')
+            return i;
+        i++;
+    }
+    // 字中含有0字节时 (w - 0x01..01) & ~w & 0x80..80 不为0
+    while (i + 8 <= n) {
+        uint64 w = *(const uint64 *)(s + i);
+        if ((w - 0x0101010101010101ul) & ~w & 0x8080808080808080ul)
+            break;
+        i += 8;
+    }
+    while (i < n && s[i] != '\0')
+        i++;
+    return i;
 }
 
 /*
  * 从用户空间拷贝字符串到内核空间
- * maxlen: 最大允许长度 (防止溢出)
+ * maxlen: 最大允许长度 (防止溢出, 超长的字符串会被截断)
  * dst: 内核缓冲区
  * src: 用户字符串地址
+ * 成功返回0, 用户地址无效返回-1
  */
-void uvm_copyin_str(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 maxlen)
+int uvm_copyin_str(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 maxlen)
 {
     uint64 n = 0;
     char *k_dst = (char *)dst;
+
+    if (maxlen == 0)
+        return 0;
     
     while (n < maxlen) {
         uint64 va = src + n;
-        pte_t *pte = vm_getpte(user_tbl, va, false);
-        
-        if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_R) || !(*pte & PTE_U)) {
-            panic("uvm_copyin_str: invalid user string ptr");
-        }
-        
-        uint64 pa = PTE_TO_PA(*pte);
         uint64 offset = va % PGSIZE;
-        char *p_str = (char *)(pa + offset);
-        
-        // 逐字节拷贝直到页边界或遇到 '\0'
-        while (n < maxlen && offset < PGSIZE) {
-            char c = *p_str;
-            k_dst[n] = c;
-            
-            if (c == '\0') return; // 拷贝完成
-            
-            n++;
-            offset++;
-            p_str++;
+
+        uint64 pa = user_page(user_tbl, va, PTE_R);
+        if (pa == 0)
+            return -1;
+
+        // 在本页范围内找结尾的'\0', 连同它一起整段拷贝
+        uint64 chunk = MIN(PGSIZE - offset, maxlen - n);
+        uint64 len = find_nul((char *)(pa + offset), chunk);
+        if (len < chunk) {
+            memmove(k_dst + n, (void *)(pa + offset), len + 1);
+            return 0;
         }
+        memmove(k_dst + n, (void *)(pa + offset), chunk);
+        n += chunk;
     }
     
     // 强制结尾，防止未截断
     k_dst[maxlen - 1] = '\0';
+    return 0;
 }
 
 /* -------------------------------------------------------------------------
- * Part 2: mmap 区域管理 (链表 + 映射)
+ * Part 2: mmap 区域管理 (链表 + AVL树 + 映射)
  * ------------------------------------------------------------------------- */
 
 // 调试工具：打印进程的 mmap 链表
@@ -125,159 +176,238 @@ void uvm_show_mmaplist(mmap_region_t *head)
     printf("\n=== Process MMAP List ===\n");
     mmap_region_t *node = head;
     while (node) {
-        printf("[%p - %p] pages=%d\n", 
+        printf("[%p - %p] pages=%d%s\n", 
                node->begin, 
                node->begin + node->npages * PGSIZE, 
-               node->npages);
+               node->npages,
+               node->ip == NULL ? "" : (node->flags & MAP_SHARED) ? " file(shared)" : " file(private)");
         node = node->next;
     }
     if (!head) printf("(empty)\n");
 }
 
-// 辅助函数：寻找一块足够大的虚拟地址空间
-static uint64 find_free_region(mmap_region_t *head, uint32 npages, mmap_region_t **out_prev)
+// 辅助：在链表中 prev 之后(prev 为NULL时在链表头)插入区域, 同时加入AVL树
+static void region_link(proc_t *p, mmap_region_t *prev, mmap_region_t *node)
 {
-    uint64 req_len = npages * PGSIZE;
-    uint64 candidate_start = MMAP_BEGIN;
-    
-    mmap_region_t *curr = head;
-    mmap_region_t *prev = NULL;
-    
-    // 遍历链表寻找空隙
-    while (curr != NULL) {
-        // 检查 [candidate_start, curr->begin) 是否够大
-        if (curr->begin >= candidate_start + req_len) {
-            if (out_prev) *out_prev = prev;
-            return candidate_start;
-        }
-        
-        // 移动候选起始点到当前区域之后
-        candidate_start = curr->begin + curr->npages * PGSIZE;
-        prev = curr;
-        curr = curr->next;
+    if (prev == NULL) {
+        node->next = p->mmap;
+        p->mmap = node;
+    } else {
+        node->next = prev->next;
+        prev->next = node;
     }
-    
-    // 检查最后一个区域之后是否有空间
-    if (candidate_start + req_len <= MMAP_END) {
-        if (out_prev) *out_prev = prev;
-        return candidate_start;
+    mmap_tree_insert(&p->mmap_tree, node);
+}
+
+// 辅助：把区域从链表(prev 是它在链表中的前一个节点)和AVL树中摘除
+static void region_unlink(proc_t *p, mmap_region_t *prev, mmap_region_t *node)
+{
+    if (prev == NULL)
+        p->mmap = node->next;
+    else
+        prev->next = node->next;
+    node->next = NULL;
+    mmap_tree_remove(&p->mmap_tree, node);
+}
+
+// 辅助：找到第一个与 [start, ...) 相交或者在它之后的区域, prev 返回它在链表中的前一个节点
+static mmap_region_t *region_first_after(proc_t *p, uint64 start, mmap_region_t **prev)
+{
+    mmap_region_t *m = mmap_tree_lookup(p->mmap_tree, start);
+    if (m != NULL && REGION_END(m) > start) {
+        *prev = (m->begin > MMAP_BEGIN) ? mmap_tree_lookup(p->mmap_tree, m->begin - 1) : NULL;
+        return m;
+    }
+    *prev = m;
+    return m ? m->next : p->mmap;
+}
+
+// 辅助：把区域 m 在 addr 处(页对齐, 严格位于区域内部)拆成两个, 返回后一半
+static mmap_region_t *region_split(proc_t *p, mmap_region_t *m, uint64 addr)
+{
+    mmap_region_t *n = mmap_region_alloc();
+    n->begin = addr;
+    n->npages = (REGION_END(m) - addr) / PGSIZE;
+    n->perm = m->perm;
+    n->flags = m->flags;
+    n->ip = m->ip ? inode_dup(m->ip) : NULL;
+    n->offset = m->offset + (addr - m->begin);
+    n->advice = m->advice;
+
+    m->npages = (addr - m->begin) / PGSIZE;
+    mmap_tree_update(&p->mmap_tree, m);
+    region_link(p, m, n);
+    return n;
+}
+
+// 辅助：预先建立区域 m 中 [start, end) 还没有映射的页面 (MAP_POPULATE / MADV_WILLNEED)
+// 可写的匿名页面直接分配私有页面, 省掉之后写入时的缺页; 文件映射到文件末尾为止
+static void region_populate(proc_t *p, mmap_region_t *m, uint64 start, uint64 end)
+{
+    bool write = (m->perm & PTE_W) && m->ip == NULL;
+
+    for (uint64 va = start; va < end; va += PGSIZE) {
+        pte_t *pte = vm_getpte(p->pgtbl, va, false);
+        if (pte != NULL && (*pte & PTE_V))
+            continue;
+        swap_balance();
+        if (uvm_lazy_fault(p->pgtbl, p->heap_top, p->mmap_tree, va, write) < 0)
+            break;
     }
-    
-    return 0; // 无空间
 }
 
 /*
- * 建立新的内存映射
+ * 建立新的内存映射 (只记录区域, 物理页在第一次访问时由 uvm_lazy_fault 分配)
+ * flags 带 MAP_POPULATE 时马上建立所有页面
+ * ip 不为NULL时是文件映射, 区域持有 ip 的一个新引用, offset 是 start 对应的文件偏移
+ * 返回映射的起始地址, 区域非法 (越界/未对齐/与已有映射重叠) 或没有足够的空隙时返回-1
  */
-void uvm_mmap(uint64 start, uint32 npages, int perm)
+uint64 uvm_mmap(uint64 start, uint32 npages, int perm, int flags, struct inode *ip, uint32 offset)
 {
     proc_t *p = myproc();
-    mmap_region_t *prev_node = NULL;
+    uint64 len = (uint64)npages * PGSIZE;
     uint64 map_addr;
+
+    if (npages == 0)
+        return -1;
     
     // 1. 确定映射地址
     if (start == 0) {
-        // 自动分配模式
-        map_addr = find_free_region(p->mmap, npages, &prev_node);
-        if (map_addr == 0) panic("uvm_mmap: out of virtual memory");
+        // 自动分配模式: 在AVL树中寻找足够大的空隙
+        // 不小于2MB的匿名映射尽量按2MB对齐放置, 这样可以使用透明大页
+        map_addr = 0;
+        if (ip == NULL && len >= THP_SIZE) {
+            map_addr = mmap_tree_find_gap(p->mmap_tree, len + THP_SIZE - PGSIZE);
+            if (map_addr != 0)
+                map_addr = ALIGN_UP(map_addr, THP_SIZE);
+        }
+        if (map_addr == 0)
+            map_addr = mmap_tree_find_gap(p->mmap_tree, len);
+        if (map_addr == 0) return -1;
     } else {
         // 指定地址模式
         map_addr = start;
-        uint64 map_end = start + npages * PGSIZE;
         
-        // 检查越界
-        if (map_addr < MMAP_BEGIN || map_end > MMAP_END) 
-            panic("uvm_mmap: invalid address range");
-            
-        // 寻找插入位置 (保持链表有序)
-        mmap_region_t *curr = p->mmap;
-        while (curr && curr->begin < map_addr) {
-            // 检查是否与当前节点重叠
-            if (curr->begin + curr->npages * PGSIZE > map_addr)
-                panic("uvm_mmap: overlap detected");
-            prev_node = curr;
-            curr = curr->next;
-        }
-        // 检查是否与后一个节点重叠
-        if (curr && map_end > curr->begin)
-            panic("uvm_mmap: overlap detected");
+        // 检查对齐和越界 (地址来自用户, 不能panic)
+        if (map_addr % PGSIZE != 0 || map_addr < MMAP_BEGIN || len > MMAP_END - map_addr)
+            return -1;
     }
+
+    // 检查是否与前后的区域重叠
+    mmap_region_t *prev_node = mmap_tree_lookup(p->mmap_tree, map_addr);
+    mmap_region_t *next_node = prev_node ? prev_node->next : p->mmap;
+    if ((prev_node && REGION_END(prev_node) > map_addr) || (next_node && map_addr + len > next_node->begin))
+        return -1;
     
     // 2. 创建并插入节点
     mmap_region_t *new_node = mmap_region_alloc();
     new_node->begin = map_addr;
     new_node->npages = npages;
-    
-    // 插入链表
-    if (prev_node == NULL) {
-        // 插在头部
-        new_node->next = p->mmap;
-        p->mmap = new_node;
-    } else {
-        // 插在中间或尾部
-        new_node->next = prev_node->next;
-        prev_node->next = new_node;
+    new_node->perm = perm;
+    if (ip != NULL) {
+        new_node->flags = (flags & MAP_SHARED) | MAP_FILE;
+        new_node->ip = inode_dup(ip);
+        new_node->offset = offset;
     }
+    region_link(p, prev_node, new_node);
     
-    // 3. 尝试合并 (Merge)
+    // 3. 尝试合并 (Merge, 只合并匿名映射)
     // 检查是否可以与 后一个节点 合并
-    if (new_node->next) {
-        mmap_region_t *next_node = new_node->next;
-        uint64 my_end = new_node->begin + new_node->npages * PGSIZE;
-        if (my_end == next_node->begin) {
-            new_node->npages += next_node->npages;
-            new_node->next = next_node->next;
-            mmap_region_free(next_node);
-        }
+    if (next_node && new_node->ip == NULL && next_node->ip == NULL &&
+        REGION_END(new_node) == next_node->begin && new_node->perm == next_node->perm &&
+        next_node->advice == MADV_NORMAL) {
+        region_unlink(p, new_node, next_node);
+        new_node->npages += next_node->npages;
+        mmap_tree_update(&p->mmap_tree, new_node);
+        mmap_region_free(next_node);
     }
     // 检查是否可以与 前一个节点 合并
-    if (prev_node) {
-        uint64 prev_end = prev_node->begin + prev_node->npages * PGSIZE;
-        if (prev_end == new_node->begin) {
-            prev_node->npages += new_node->npages;
-            prev_node->next = new_node->next;
-            mmap_region_free(new_node);
-        }
+    if (prev_node && new_node->ip == NULL && prev_node->ip == NULL &&
+        REGION_END(prev_node) == new_node->begin && prev_node->perm == new_node->perm &&
+        prev_node->advice == new_node->advice) {
+        region_unlink(p, prev_node, new_node);
+        prev_node->npages += new_node->npages;
+        mmap_tree_update(&p->mmap_tree, prev_node);
+        mmap_region_free(new_node);
+        new_node = prev_node;
     }
-    
-    // 4. 分配物理内存并建立页表映射
-    uint64 va = map_addr;
-    for (int i = 0; i < npages; i++) {
-        void *pa = pmem_alloc(false); // 分配用户物理页
-        if (!pa) panic("uvm_mmap: pmem alloc failed");
-        
-        memset(pa, 0, PGSIZE); // 清零
-        vm_mappages(p->pgtbl, va, (uint64)pa, PGSIZE, perm);
-        va += PGSIZE;
+
+    if (flags & MAP_POPULATE)
+        region_populate(p, new_node, map_addr, map_addr + len);
+
+    return map_addr;
+}
+
+// mmap_writeback 的参数
+typedef struct writeback_arg {
+    mmap_region_t *m;
+    bool clean;
+    bool cleaned;
+} writeback_arg_t;
+
+static void writeback_one(pte_t *pte, uint64 va, int level, void *arg)
+{
+    writeback_arg_t *wa = (writeback_arg_t *)arg;
+    if (!(*pte & PTE_D))
+        return;
+    if (wa->clean) {
+        *pte &= ~PTE_D;
+        wa->cleaned = true;
     }
+    inode_sync_page(wa->m->ip, wa->m->offset + (va - wa->m->begin));
+}
+
+/*
+ * 辅助：把共享文件映射 m 中 [start, end) 范围内被写过的页面写回文件
+ * clean 为真时清除 PTE_D, 之后的写入会让硬件重新设置它 (msync之后映射仍然有效)
+ * 写回期间只有当前进程能写这些页面, 而它正在系统调用里, 所以最后统一刷新一次TLB
+ */
+static void mmap_writeback(pgtbl_t pgtbl, mmap_region_t *m, uint64 start, uint64 end, bool clean)
+{
+    if (m->ip == NULL || !(m->flags & MAP_SHARED) || !(m->perm & PTE_W) || start >= end)
+        return;
+
+    writeback_arg_t arg = { .m = m, .clean = clean, .cleaned = false };
+    vm_walk(pgtbl, start, end - start, writeback_one, &arg);
+    if (arg.cleaned)
+        uvm_flush_tlb(pgtbl, start, end - start);
+}
+
+/*
+ * 辅助：解除 [va, va + len) 的映射并释放物理页, 然后刷新TLB
+ * 释放了中间页表页时刷新整个地址空间 (TLB中可能缓存了指向它的非叶子表项)
+ */
+static void unmap_user_range(pgtbl_t pgtbl, uint64 va, uint64 len)
+{
+    if (vm_unmappages(pgtbl, va, len, true))
+        uvm_flush_tlb(pgtbl, 0, VA_MAX);
+    else
+        uvm_flush_tlb(pgtbl, va, len);
 }
 
 /*
- * 解除内存映射
+ * 解除内存映射 (共享文件映射的脏页先写回文件)
+ * 成功返回0, 区域未对齐或越界返回-1
  */
-void uvm_munmap(uint64 start, uint32 npages)
+int uvm_munmap(uint64 start, uint32 npages)
 {
     proc_t *p = myproc();
-    uint64 unmap_end = start + npages * PGSIZE;
+    uint64 len = (uint64)npages * PGSIZE;
     
-    if (start < MMAP_BEGIN || unmap_end > MMAP_END)
-        panic("uvm_munmap: address out of range");
+    if (start % PGSIZE != 0 || start < MMAP_BEGIN || start > MMAP_END || len > MMAP_END - start)
+        return -1;
+    uint64 unmap_end = start + len;
         
-    mmap_region_t *walker = p->mmap;
-    mmap_region_t *prev = NULL;
+    mmap_region_t *prev;
+    mmap_region_t *walker = region_first_after(p, start, &prev);
     
     while (walker) {
-        uint64 region_end = walker->begin + walker->npages * PGSIZE;
+        uint64 region_end = REGION_END(walker);
         
         // 检查区间是否有交集
         if (unmap_end <= walker->begin) {
             break; 
         }
-        if (start >= region_end) {
-            prev = walker;
-            walker = walker->next;
-            continue;
-        }
         
         // 有交集，计算实际需要解映射的范围
         uint64 overlap_start = (start > walker->begin) ? start : walker->begin;
@@ -285,16 +415,15 @@ void uvm_munmap(uint64 start, uint32 npages)
         uint64 overlap_len = overlap_end - overlap_start;
         
         // 1. 执行页表解映射和物理页释放
-        vm_unmappages(p->pgtbl, overlap_start, overlap_len, true);
+        mmap_writeback(p->pgtbl, walker, overlap_start, overlap_end, false);
+        unmap_user_range(p->pgtbl, overlap_start, overlap_len);
         
         // 2. 更新链表节点结构
         if (start <= walker->begin && unmap_end >= region_end) {
             // Case A: 完全覆盖 (Remove Node)
             mmap_region_t *victim = walker;
-            if (prev) prev->next = walker->next;
-            else p->mmap = walker->next;
-            
             walker = walker->next; 
+            region_unlink(p, prev, victim);
             mmap_region_free(victim);
             continue; 
         }
@@ -303,28 +432,101 @@ void uvm_munmap(uint64 start, uint32 npages)
             uint32 cut_pages = (unmap_end - walker->begin) / PGSIZE;
             walker->begin = unmap_end;
             walker->npages -= cut_pages;
+            walker->offset += cut_pages * PGSIZE;
+            mmap_tree_update(&p->mmap_tree, walker);
             break;
         }
         else if (start > walker->begin && unmap_end >= region_end) {
             // Case C: 尾部截断 (Trim Tail)
             uint32 cut_pages = (region_end - start) / PGSIZE;
             walker->npages -= cut_pages;
+            mmap_tree_update(&p->mmap_tree, walker);
             prev = walker;
             walker = walker->next;
             continue; 
         }
         else {
             // Case D: 中间打洞 (Split)
-            mmap_region_t *new_node = mmap_region_alloc();
-            new_node->begin = unmap_end;
-            new_node->npages = (region_end - unmap_end) / PGSIZE;
-            new_node->next = walker->next;
-            
+            region_split(p, walker, unmap_end);
             walker->npages = (start - walker->begin) / PGSIZE;
-            walker->next = new_node;
+            mmap_tree_update(&p->mmap_tree, walker);
             break;
         }
     }
+    return 0;
+}
+
+/*
+ * 把 [start, start + npages * PGSIZE) 中共享文件映射的脏页写回文件, 映射保持不变
+ */
+void uvm_msync(uint64 start, uint32 npages)
+{
+    proc_t *p = myproc();
+    uint64 end = start + npages * PGSIZE;
+    mmap_region_t *prev;
+
+    for (mmap_region_t *m = region_first_after(p, start, &prev); m != NULL && m->begin < end; m = m->next)
+        mmap_writeback(p->pgtbl, m, MAX(start, m->begin), MIN(end, REGION_END(m)), true);
+}
+
+/*
+ * 对 [start, start + npages * PGSIZE) 中的mmap区域给出访问模式提示 (见 MADV_*)
+ * 范围中有没有映射的地址时, 对映射了的部分照常处理, 但返回-1
+ */
+int uvm_madvise(uint64 start, uint32 npages, int advice)
+{
+    proc_t *p = myproc();
+    uint64 end = start + (uint64)npages * PGSIZE;
+    uint64 covered = start;
+    int ret = 0;
+    mmap_region_t *prev;
+
+    if (start % PGSIZE != 0 || start < MMAP_BEGIN || end > MMAP_END)
+        return -1;
+    if (advice < MADV_NORMAL || advice > MADV_DONTNEED)
+        return -1;
+
+    mmap_region_t *m = region_first_after(p, start, &prev);
+    while (m != NULL && m->begin < end) {
+        if (m->begin > covered)
+            ret = -1;
+        uint64 lo = MAX(start, m->begin);
+        uint64 hi = MIN(end, REGION_END(m));
+
+        switch (advice) {
+        case MADV_WILLNEED:
+            region_populate(p, m, lo, hi);
+            break;
+        case MADV_DONTNEED:
+            // 区域保留, 之后的访问重新缺页 (私有映射的修改会丢失)
+            mmap_writeback(p->pgtbl, m, lo, hi, false);
+            unmap_user_range(p->pgtbl, lo, hi - lo);
+            break;
+        default:
+            // 访问模式记录在区域里, 只覆盖区域的一部分时先拆开
+            if (m->advice != advice) {
+                if (lo > m->begin)
+                    m = region_split(p, m, lo);
+                if (hi < REGION_END(m))
+                    region_split(p, m, hi);
+                m->advice = advice;
+            }
+            break;
+        }
+        covered = hi;
+        m = m->next;
+    }
+    if (covered < end)
+        ret = -1;
+    return ret;
+}
+
+/* 解除当前进程的全部内存映射 (exit和exec时调用, 共享文件映射的脏页会写回文件) */
+void uvm_munmap_all()
+{
+    proc_t *p = myproc();
+    while (p->mmap)
+        uvm_munmap(p->mmap->begin, p->mmap->npages);
 }
 
 /* -------------------------------------------------------------------------
@@ -333,29 +535,169 @@ void uvm_munmap(uint64 start, uint32 npages)
 
 /*
  * [修复] 堆增长
+ * 只移动堆顶, 新的堆页面在第一次访问时由 uvm_lazy_fault 分配
  */
 uint64 uvm_heap_grow(pgtbl_t pgtbl, uint64 cur_heap_top, uint32 len) 
 {
     uint64 new_heap_top = cur_heap_top + len;
-    
-    // 从当前 top 向上对齐到页边界
-    uint64 a = (cur_heap_top + PGSIZE - 1) & ~(PGSIZE - 1);
-    
-    for (; a < new_heap_top; a += PGSIZE) {
-        // 分配用户页 (参数 false)
-        void *mem = pmem_alloc(false);
-        if (mem == NULL) {
-            // 分配失败，回滚操作（可选，这里简单返回0）
-            // 在实际系统中可能需要 unmap 之前分配的页
-            return 0; 
+
+    // 堆不能长进 mmap 区域
+    if (new_heap_top < cur_heap_top || new_heap_top > MMAP_BEGIN)
+        return cur_heap_top;
+
+    return new_heap_top;
+}
+
+/*
+ * 映射共享零页 (只读访问的匿名页面和BSS)
+ * 可写的页面以写时复制的方式映射, 第一次写入时由 uvm_cow_fault 换成私有页面
+ */
+void uvm_map_zero(pgtbl_t pgtbl, uint64 va, uint64 len, int perm)
+{
+    uint64 zero = pmem_zero_page();
+
+    if (perm & PTE_W)
+        perm = (perm & ~PTE_W) | PTE_COW;
+    for (uint64 off = 0; off < len; off += PGSIZE) {
+        pmem_page_get(zero);
+        vm_mappages(pgtbl, va + off, zero, PGSIZE, perm);
+    }
+}
+
+// 透明大页的统计
+static uint64 thp_faults;    // 缺页时直接分配的大页
+static uint64 thp_fallbacks; // 可以用大页但没有连续内存, 退回4KB页面的缺页
+static uint64 thp_collapses; // 后台合并成的大页
+
+// 辅助：2MB对齐的范围 [base, base + THP_SIZE) 是否完整落在堆(region为NULL)或者匿名区域 region 中
+static bool thp_range_ok(uint64 heap_top, mmap_region_t *region, uint64 base)
+{
+    if (region == NULL)
+        return base >= USER_BASE && base + THP_SIZE <= ALIGN_UP(heap_top, PGSIZE);
+    return region->ip == NULL && base >= region->begin && base + THP_SIZE <= REGION_END(region);
+}
+
+/*
+ * 辅助：va 所在的2MB范围可以使用大页且还没有任何映射时, 分配一个2MB的块直接映射
+ * 成功返回0; 不满足条件或者没有足够大的连续物理内存时返回-1, 由调用者退回到4KB页面
+ */
+static int thp_fault(pgtbl_t pgtbl, uint64 heap_top, mmap_region_t *region, uint64 va, int perm)
+{
+    uint64 base = ALIGN_DOWN(va, THP_SIZE);
+    if (!thp_range_ok(heap_top, region, base))
+        return -1;
+
+    // 已经有最后一级页表(或者已经是大页): 范围内有4KB页面, 留给后台合并
+    int lv;
+    pte_t *pte = __vm_getpte(pgtbl, base, false, 1, &lv);
+    if (pte != NULL && (*pte & PTE_V))
+        return -1;
+
+    void *mem = pmem_alloc_pages(THP_ORDER, false);
+    if (mem == NULL) {
+        thp_fallbacks++;
+        return -1;
+    }
+    pte = __vm_getpte(pgtbl, base, true, 1, &lv);
+    if (pte == NULL) {
+        pmem_free_pages((uint64)mem, THP_ORDER, false);
+        return -1;
+    }
+    *pte = PA_TO_PTE(mem) | perm | PTE_V;
+    uvm_flush_tlb(pgtbl, base, THP_SIZE);
+    thp_faults++;
+    return 0;
+}
+
+// 辅助：把文件映射 m 中 va 所在的页面映射到块缓冲区的物理页, 超出文件末尾返回-1
+// 只有可写的共享映射需要为文件空洞分配磁盘块, 其余映射在空洞处映射共享零页
+static int map_file_page(mmap_region_t *m, uint64 va, pte_t *pte)
+{
+    bool alloc = (m->flags & MAP_SHARED) && (m->perm & PTE_W);
+    uint64 pa = inode_map_page(m->ip, m->offset + (va - m->begin), alloc);
+    if (pa == 0)
+        return -1;
+
+    // 私有映射不能改动缓冲区: 可写的页面以写时复制的方式映射
+    int perm = m->perm;
+    if (!(m->flags & MAP_SHARED) && (perm & PTE_W))
+        perm = (perm & ~PTE_W) | PTE_COW;
+    *pte = PA_TO_PTE(pa) | perm | PTE_V;
+    return 0;
+}
+
+/*
+ * 按需分配 (demand-zero): 处理对堆或 mmap 区域中尚未分配页面的访问
+ * 写访问时匿名内存所在的2MB范围可以使用大页就直接映射一个大页
+ * 否则写访问给 va 所在的页面分配一个全0的物理页; 读访问只映射共享零页 (稀疏读取不占内存,
+ * 写满之后由 uvm_thp_scan 合并成大页), 都按区域的权限映射
+ * 文件映射的页面则直接映射块缓冲区的物理页 (可能需要读磁盘而睡眠)
+ * 并按区域的访问模式(advice)预读后面的几个页面
+ * 页面在交换区中时把它读回来 (睡眠), 用户栈中的页面也一样
+ * 成功返回0, va 不属于堆和 mmap 区域, 已经映射或者超出文件末尾返回-1
+ */
+int uvm_lazy_fault(pgtbl_t pgtbl, uint64 heap_top, mmap_region_t *mmap_tree, uint64 va, bool write)
+{
+    int perm = 0;
+    mmap_region_t *region = NULL;
+    va = ALIGN_DOWN(va, PGSIZE);
+
+    // 换出的页面不论属于哪个区域(包括增长出来的用户栈)都在这里读回来
+    int lv = 0;
+    pte_t *pte = __vm_getpte(pgtbl, va, false, 0, &lv);
+    if (pte != NULL && lv == 0 && PTE_IS_SWAP(*pte))
+        return swap_in(pgtbl, va, pte);
+
+    if (va >= USER_BASE && va < heap_top) {
+        perm = PTE_R | PTE_W | PTE_U;
+    } else {
+        mmap_region_t *m = mmap_tree_lookup(mmap_tree, va);
+        if (m != NULL && va < REGION_END(m)) {
+            perm = m->perm;
+            region = m;
         }
-        memset(mem, 0, PGSIZE);
-        
-        // 建立映射，堆通常是可读写的，且用户可访问
-        vm_mappages(pgtbl, a, (uint64)mem, PGSIZE, PTE_R | PTE_W | PTE_U);
     }
-    
-    return new_heap_top;
+    if (perm == 0)
+        return -1;
+
+    if (write && (region == NULL || region->ip == NULL) && thp_fault(pgtbl, heap_top, region, va, perm) == 0)
+        return 0;
+
+    pte = vm_getpte(pgtbl, va, true);
+    if (pte == NULL || (*pte & PTE_V))
+        return -1;
+
+    uint64 pa;
+    if (region == NULL || region->ip == NULL) {
+        if (!write) {
+            uvm_map_zero(pgtbl, va, PGSIZE, perm);
+            uvm_flush_tlb(pgtbl, va, PGSIZE);
+            return 0;
+        }
+        pa = (uint64)pmem_alloc(false);
+        *pte = PA_TO_PTE(pa) | perm | PTE_V;
+        uvm_flush_tlb(pgtbl, va, PGSIZE);
+        return 0;
+    }
+
+    uint32 window = MMAP_READAHEAD_NORMAL;
+    if (region->advice == MADV_RANDOM)
+        window = 1;
+    else if (region->advice == MADV_SEQUENTIAL)
+        window = MMAP_READAHEAD_SEQ;
+    uint64 end = MIN(va + (uint64)window * PGSIZE, REGION_END(region));
+
+    if (map_file_page(region, va, pte) < 0)
+        return -1;
+    // 预读: 遇到已经映射的页面或者文件末尾就停下
+    uint64 a;
+    for (a = va + PGSIZE; a < end; a += PGSIZE) {
+        pte = vm_getpte(pgtbl, a, true);
+        if (pte == NULL || (*pte & PTE_V) || map_file_page(region, a, pte) < 0)
+            break;
+    }
+    uvm_flush_tlb(pgtbl, va, a - va);
+    return 0;
 }
 
 // 堆收缩
@@ -374,7 +716,7 @@ uint64 uvm_heap_ungrow(pgtbl_t tbl, uint64 current_top, uint32 bytes)
         page_aligned_new = USER_BASE + PGSIZE;
         
     if (page_aligned_curr > page_aligned_new) {
-        vm_unmappages(tbl, page_aligned_new, page_aligned_curr - page_aligned_new, true);
+        unmap_user_range(tbl, page_aligned_new, page_aligned_curr - page_aligned_new);
     }
     
     return new_top;
@@ -404,6 +746,7 @@ uint64 uvm_ustack_grow(pgtbl_t tbl, uint64 current_pages, uint64 fault_addr)
         }
         vm_mappages(tbl, va, (uint64)mem, PGSIZE, PTE_R | PTE_W | PTE_U);
     }
+    uvm_flush_tlb(tbl, target_bottom, current_bottom - target_bottom);
     
     return current_pages + pages_needed;
 }
@@ -412,7 +755,7 @@ uint64 uvm_ustack_grow(pgtbl_t tbl, uint64 current_pages, uint64 fault_addr)
  * Part 4: 页表生命周期 (Copy & Destroy)
  * ------------------------------------------------------------------------- */
 
-// 递归销毁页表及其映射的物理内存
+// 递归销毁页表及其映射的物理内存 (只进入有效的页表页, 开销与页表页数量成正比)
 static void free_pagetable_recursive(pgtbl_t tbl, int level)
 {
     for (int i = 0; i < 512; i++) {
@@ -420,74 +763,414 @@ static void free_pagetable_recursive(pgtbl_t tbl, int level)
         if (pte & PTE_V) {
             uint64 child_pa = PTE_TO_PA(pte);
             
-            if (level > 0) {
+            if (level > 0 && PTE_CHECK(pte)) {
                 // 中间层：递归释放下一级页表
                 free_pagetable_recursive((pgtbl_t)child_pa, level - 1);
-            } else {
-                // 叶子层：如果是用户页 (PTE_U)，则释放物理内存
-                if (pte & PTE_U) {
+            } else if (pte & PTE_U) {
+                // 叶子：释放用户页面 (第1级的叶子是一整个透明大页)
+                if (level == 0)
                     pmem_free(child_pa, false);
-                }
+                else
+                    pmem_free_pages(child_pa, THP_ORDER, false);
             }
+        } else if (level == 0 && PTE_IS_SWAP(pte)) {
+            swap_free(PTE_TO_SLOT(pte));
         }
     }
     // 释放当前页表页本身
     pmem_free((uint64)tbl, true);
 }
 
-// 销毁进程页表
+// 销毁进程页表 (trampoline和trapframe没有PTE_U, 不会被释放)
 void uvm_destroy_pgtbl(pgtbl_t tbl)
 {
     free_pagetable_recursive(tbl, 2); // SV39 顶层为 level 2
 }
 
-// 辅助：拷贝一段虚拟地址范围的内存
-static int copy_virt_range(pgtbl_t src_tbl, pgtbl_t dst_tbl, uint64 start, uint64 end)
+// 辅助：子进程共享父进程的一个页面
+static void copy_one(pte_t *pte, uint64 va, int level, void *arg)
 {
-    for (uint64 va = start; va < end; va += PGSIZE) {
-        pte_t *src_pte = vm_getpte(src_tbl, va, false);
-        if (!src_pte || !(*src_pte & PTE_V)) 
-            panic("uvm_copy: source pte missing");
-            
-        uint64 src_pa = PTE_TO_PA(*src_pte);
-        int flags = PTE_FLAGS(*src_pte);
-        
-        // 分配新物理页
-        void *dst_pa = pmem_alloc(false);
-        if (!dst_pa) return -1;
-        
-        // 深拷贝内存内容
-        memmove(dst_pa, (void *)src_pa, PGSIZE);
-        
-        // 建立新映射
-        vm_mappages(dst_tbl, va, (uint64)dst_pa, PGSIZE, flags);
+    uint64 pa = PTE_TO_PA(*pte);
+    pmem_page_get(pa);
+    vm_mappages((pgtbl_t)arg, va, pa, PGSIZE, PTE_FLAGS(*pte));
+}
+
+// 辅助：子进程共享父进程换出到交换区的一个页面
+static void copy_swap_one(pte_t *pte, uint64 va, int level, void *arg)
+{
+    swap_dup(PTE_TO_SLOT(*pte));
+    *vm_getpte((pgtbl_t)arg, va, true) = *pte;
+}
+
+// 辅助：让子进程共享一段虚拟地址范围的内存 (写时复制)
+// 可写的页面在父子两边都变成只读 + PTE_COW, 只读的页面直接共享
+// shared 为真时(共享文件映射)可写的页面也直接共享
+// 还没有访问过的堆/mmap 页面在子进程中同样按需分配
+// 大页不在进程之间共享, 先拆成4KB页面 (之后可以由后台重新合并)
+// 父进程的页表项被修改后需要刷新TLB (见 uvm_copy_pgtbl 末尾)
+static void copy_virt_range(pgtbl_t src_tbl, pgtbl_t dst_tbl, uint64 start, uint64 end, bool shared)
+{
+    for (uint64 a = ALIGN_DOWN(start, THP_SIZE); a < end; a += THP_SIZE)
+        vm_split_huge(src_tbl, a);
+    if (!shared)
+        vm_protect(src_tbl, start, end - start, PTE_W, PTE_COW);
+    vm_walk(src_tbl, start, end - start, copy_one, dst_tbl);
+    vm_walk_swap(src_tbl, start, end - start, copy_swap_one, dst_tbl);
+}
+
+/*
+ * 处理对写时复制页面的写入 (store page fault 或者 uvm_copyout)
+ * 只剩自己一个使用者时直接恢复写权限, 否则复制一份私有的页面
+ * 成功返回0, 不是写时复制页面返回-1
+ */
+int uvm_cow_fault(pgtbl_t pgtbl, uint64 va)
+{
+    if (va >= VA_MAX)
+        return -1;
+
+    pte_t *pte = vm_getpte(pgtbl, ALIGN_DOWN(va, PGSIZE), false);
+    if (pte == NULL || (*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+        return -1;
+
+    uint64 pa = PTE_TO_PA(*pte);
+    int flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    // 零页不需要拷贝, 直接换成一个全0的私有页面
+    if (pa == pmem_zero_page()) {
+        *pte = PA_TO_PTE((uint64)pmem_alloc(false)) | flags;
+        pmem_free(pa, false);
+        uvm_flush_tlb(pgtbl, va, PGSIZE);
+        return 0;
+    }
+
+    if (pmem_page(pa)->ref == 1) {
+        // 其他进程都已经放弃了这个页面: 重新据为己有
+        *pte = PA_TO_PTE(pa) | flags;
+        uvm_flush_tlb(pgtbl, va, PGSIZE);
+        return 0;
     }
+
+    // 马上会被完整覆盖, 不需要清零
+    void *mem = pmem_alloc_flags(false, 0);
+    memmove(mem, (void *)pa, PGSIZE);
+    *pte = PA_TO_PTE((uint64)mem) | flags;
+    pmem_free(pa, false);
+    uvm_flush_tlb(pgtbl, va, PGSIZE);
+
     return 0;
 }
 
-// 复制父进程的地址空间到子进程 (Fork)
+// 复制父进程的地址空间到子进程 (Fork, 写时复制)
 void uvm_copy_pgtbl(pgtbl_t old_tbl, pgtbl_t new_tbl, uint64 heap_top, uint64 ustack_pages, mmap_region_t *mmap_head)
 {
     // 1. 复制代码段
-    copy_virt_range(old_tbl, new_tbl, USER_BASE, USER_BASE + PGSIZE);
+    copy_virt_range(old_tbl, new_tbl, USER_BASE, USER_BASE + PGSIZE, false);
     
     // 2. 复制堆
     if (heap_top > USER_BASE + PGSIZE) {
         uint64 heap_end = (heap_top + PGSIZE - 1) & ~(PGSIZE - 1);
-        copy_virt_range(old_tbl, new_tbl, USER_BASE + PGSIZE, heap_end);
+        copy_virt_range(old_tbl, new_tbl, USER_BASE + PGSIZE, heap_end, false);
     }
     
     // 3. 复制栈
     if (ustack_pages > 0) {
         uint64 stack_base = TRAPFRAME - ustack_pages * PGSIZE;
-        copy_virt_range(old_tbl, new_tbl, stack_base, TRAPFRAME);
+        copy_virt_range(old_tbl, new_tbl, stack_base, TRAPFRAME, false);
     }
     
     // 4. 复制 mmap 区域
     mmap_region_t *walker = mmap_head;
     while (walker) {
         uint64 end = walker->begin + walker->npages * PGSIZE;
-        copy_virt_range(old_tbl, new_tbl, walker->begin, end);
+        copy_virt_range(old_tbl, new_tbl, walker->begin, end, (walker->flags & MAP_SHARED) != 0);
         walker = walker->next;
     }
-}
\ No newline at end of file
+
+    // 父进程的可写页面都变成了只读
+    uvm_flush_tlb(old_tbl, 0, VA_MAX);
+}
+
+/*
+ * 辅助：尝试把 [base, base + THP_SIZE) 的4KB页面合并成一个大页 (perm 是区域的权限)
+ * 要求范围内的页面没有和其他进程共享, 也没有被换出, 没有分配的页面(或者零页)不超过THP_MAX_PTES_NONE个
+ * 不从直接回收中要内存: 没有空闲的连续块就放弃, 等下一次扫描
+ */
+static bool thp_collapse(pgtbl_t pgtbl, uint64 base, int perm)
+{
+    int lv;
+    pte_t *l1 = __vm_getpte(pgtbl, base, false, 1, &lv);
+    if (l1 == NULL || !(*l1 & PTE_V) || lv != 1 || !PTE_CHECK(*l1))
+        return false;
+
+    pgtbl_t l0 = (pgtbl_t)PTE_TO_PA(*l1);
+    uint64 zero = pmem_zero_page();
+    uint32 none = 0;
+    for (int i = 0; i < 512; i++) {
+        if (PTE_IS_SWAP(l0[i]))
+            return false;
+        if (!(l0[i] & PTE_V) || PTE_TO_PA(l0[i]) == zero)
+            none++;
+        else if (pmem_page(PTE_TO_PA(l0[i]))->ref != 1)
+            return false;
+    }
+    if (none > THP_MAX_PTES_NONE)
+        return false;
+
+    uint64 mem = (uint64)pmem_alloc_pages(THP_ORDER, false);
+    if (mem == 0)
+        return false;
+    for (int i = 0; i < 512; i++) {
+        if ((l0[i] & PTE_V) && PTE_TO_PA(l0[i]) != zero)
+            memmove((void *)(mem + i * PGSIZE), (void *)PTE_TO_PA(l0[i]), PGSIZE);
+    }
+
+    // 换上大页; 释放了最后一级页表, TLB中缓存的非叶子表项也要刷新
+    *l1 = PA_TO_PTE(mem) | perm | PTE_V;
+    uvm_flush_tlb(pgtbl, 0, VA_MAX);
+    for (int i = 0; i < 512; i++) {
+        if (l0[i] & PTE_V)
+            pmem_free(PTE_TO_PA(l0[i]), false);
+    }
+    pmem_free((uint64)l0, true);
+    thp_collapses++;
+    return true;
+}
+
+/*
+ * 后台合并透明大页: 扫描当前进程的堆和匿名mmap区域, 最多合并 THP_SCAN_MAX 个大页
+ * 由时钟中断每隔 THP_SCAN_TICKS 个节拍调用一次 (只修改当前进程自己的页表)
+ */
+void uvm_thp_scan()
+{
+    proc_t *p = myproc();
+    uint32 done = 0;
+
+    for (uint64 a = ALIGN_UP(USER_BASE, THP_SIZE); done < THP_SCAN_MAX && thp_range_ok(p->heap_top, NULL, a); a += THP_SIZE) {
+        if (thp_collapse(p->pgtbl, a, PTE_R | PTE_W | PTE_U))
+            done++;
+    }
+
+    for (mmap_region_t *m = p->mmap; m != NULL && done < THP_SCAN_MAX; m = m->next) {
+        for (uint64 a = ALIGN_UP(m->begin, THP_SIZE); done < THP_SCAN_MAX && thp_range_ok(p->heap_top, m, a); a += THP_SIZE) {
+            if (thp_collapse(p->pgtbl, a, m->perm))
+                done++;
+        }
+    }
+}
+
+/* 输出透明大页的统计 (for debug) */
+void uvm_thp_print_info()
+{
+    printf("thp: faults = %d, fallbacks = %d, collapses = %d\n", thp_faults, thp_fallbacks, thp_collapses);
+}
+
+/* -------------------------------------------------------------------------
+ * Part 5: ASID 与 TLB 刷新
+ * -------------------------------------------------------------------------
+ * 每个进程的用户页表带一个ASID, 在进程之间切换时TLB中其他进程的表项可以保留
+ * - ASID 0 留给内核页表, 用户进程使用 1 ~ asid_max
+ * - ASID按代(generation)分配: 一代之内每个ASID只分配一次, 用完后进入下一代,
+ *   所有CPU在下一次返回用户态前刷新整个TLB, 旧一代的进程重新分配ASID
+ * - 进程的cpu_mask记录它在哪些CPU上运行过(那些CPU的TLB中可能有它的表项)
+ *   修改页表后本CPU直接刷新, cpu_mask中的其他CPU通过IPI按范围刷新 (uvm_flush_tlb)
+ *   这样进程迁移到其他CPU时不需要再刷新
+ * 硬件不支持ASID(asid_max == 0)或者关闭了ASID时, 退回到每次切换页表都刷新整个TLB
+ */
+
+static spinlock_t asid_lock;
+static uint64 asid_generation = 1;  // 当前的代 (进程的asid_gen为0表示从未分配)
+static uint32 asid_next = 1;        // 当前代中下一个可分配的ASID
+static uint32 asid_max;             // 硬件支持的最大ASID
+static bool asid_flush_pending[NCPU]; // 进入新的一代后各个CPU需要刷新整个TLB
+static bool asid_enabled = true;
+
+static tlb_mailbox_t tlb_mailbox[NCPU]; // 每个CPU接收TLB刷新请求的邮箱
+static uint64 tlb_ipi_sent[NCPU];       // 每个CPU发出的shootdown数量
+static uint64 tlb_ipi_recv[NCPU];       // 每个CPU处理的shootdown数量
+
+/* 探测硬件支持的ASID位数 (在hart 0开启分页之后调用) */
+void uvm_asid_init()
+{
+    spinlock_init(&asid_lock, "asid");
+
+    // 向ASID字段写入全1, 读回来的就是硬件实现的位
+    uint64 satp = r_satp();
+    w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+    asid_max = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+    w_satp(satp);
+    sfence_vma();
+}
+
+/* 打开或关闭ASID (用于对比测试), 返回之前的状态 */
+bool uvm_asid_enable(bool enable)
+{
+    spinlock_acquire(&asid_lock);
+    bool old = asid_enabled;
+    // 关闭期间没有记录cpu_mask, 重新打开时进入新的一代, 让所有CPU整体刷新一次
+    if (enable && !old) {
+        asid_generation++;
+        asid_next = 1;
+        for (int i = 0; i < NCPU; i++)
+            asid_flush_pending[i] = true;
+    }
+    asid_enabled = enable;
+    spinlock_release(&asid_lock);
+    return old;
+}
+
+/*
+ * 准备返回用户态: 确定进程的ASID并返回要写入satp的值
+ * flush 返回切换页表后是否需要刷新整个TLB
+ * 调用者需要关中断
+ */
+uint64 uvm_activate(proc_t *p, bool *flush)
+{
+    int cpu = mycpuid();
+
+    if (!asid_enabled || asid_max == 0) {
+        // 每次切换都会刷新整个TLB, 也就不存在残留表项
+        p->cpu_mask = 0;
+        *flush = true;
+        return MAKE_SATP(p->pgtbl);
+    }
+
+    bool full_flush = false;
+    if (p->asid_gen != asid_generation || asid_flush_pending[cpu]) {
+        spinlock_acquire(&asid_lock);
+        if (p->asid_gen != asid_generation) {
+            if (asid_next > asid_max) {
+                // 当前代的ASID用完了: 进入下一代
+                asid_generation++;
+                asid_next = 1;
+                for (int i = 0; i < NCPU; i++)
+                    asid_flush_pending[i] = true;
+            }
+            p->asid = asid_next++;
+            p->asid_gen = asid_generation;
+            // 新的ASID在所有CPU上都没有表项 (上一代的表项在进入新一代时整体刷新)
+            p->cpu_mask = 0;
+        }
+        full_flush = asid_flush_pending[cpu];
+        asid_flush_pending[cpu] = false;
+        spinlock_release(&asid_lock);
+    }
+
+    if (full_flush)
+        sfence_vma();
+    __sync_fetch_and_or(&p->cpu_mask, 1u << cpu);
+
+    *flush = false;
+    return MAKE_SATP_ASID(p->pgtbl, p->asid);
+}
+
+/* 在本CPU上刷新asid在 [va, va + len) 的表项, 范围较大时刷新整个ASID */
+static void tlb_flush_local(uint32 asid, uint64 va, uint64 len)
+{
+    if (len > TLB_FLUSH_MAX_PAGES * PGSIZE) {
+        sfence_vma_asid(asid);
+        return;
+    }
+    for (uint64 a = ALIGN_DOWN(va, PGSIZE); a < va + len; a += PGSIZE)
+        sfence_vma_va_asid(a, asid);
+}
+
+/*
+ * 处理其他CPU发给本CPU的TLB刷新请求
+ * 由S-mode软件中断调用, 也在自旋等待(发送方等待应答/等锁)时调用, 调用者需要关中断
+ */
+void uvm_tlb_ipi()
+{
+    int cpu = mycpuid();
+    tlb_mailbox_t *mb = &tlb_mailbox[cpu];
+
+    if (!mb->pending)
+        return;
+    __sync_synchronize();
+    tlb_flush_local(mb->asid, mb->va, mb->len);
+    tlb_ipi_recv[cpu]++;
+    __sync_synchronize();
+    mb->pending = 0;
+}
+
+/*
+ * 辅助：刷新 mask 中的CPU上asid在 [va, va + len) 的表项
+ * 本CPU直接刷新, 其他CPU各发一个IPI, 等它们都刷新完才返回
+ * 调用者不能在等待期间被迁移, 所以这里关中断; 其他CPU在等锁时也会处理请求, 持有锁调用也不会死锁
+ */
+static void tlb_shootdown(uint32 mask, uint32 asid, uint64 va, uint64 len)
+{
+    push_off();
+    int self = mycpuid();
+    uint32 sent = 0;
+
+    if (mask & (1u << self))
+        tlb_flush_local(asid, va, len);
+
+    // 先把所有请求发出去, 再统一等应答
+    for (int i = 0; i < boot_info.ncpu; i++) {
+        if (i == self || !(mask & (1u << i)))
+            continue;
+        tlb_mailbox_t *mb = &tlb_mailbox[i];
+        while (__sync_lock_test_and_set(&mb->busy, 1) != 0)
+            uvm_tlb_ipi();
+        mb->asid = asid;
+        mb->va = va;
+        mb->len = len;
+        __sync_synchronize();
+        mb->pending = 1;
+        ipi_send(i);
+        sent |= 1u << i;
+        tlb_ipi_sent[self]++;
+    }
+
+    for (int i = 0; i < boot_info.ncpu; i++) {
+        if (!(sent & (1u << i)))
+            continue;
+        while (tlb_mailbox[i].pending)
+            uvm_tlb_ipi();
+        __sync_lock_release(&tlb_mailbox[i].busy);
+    }
+    pop_off();
+}
+
+/*
+ * 进程p修改了页表中 [va, va + len) 的映射后调用
+ * 只通知cpu_mask中的CPU, 它们都刷新完才返回 (之后才能释放被解除映射的物理页)
+ * 没有使用ASID时trampoline在进入内核时已经刷新了整个TLB, 不需要再做什么
+ */
+void uvm_flush_tlb_proc(proc_t *p, uint64 va, uint64 len)
+{
+    uint32 mask = p->cpu_mask;
+    if (mask == 0 || len == 0)
+        return;
+    tlb_shootdown(mask, p->asid, va, len);
+}
+
+/*
+ * 内核页表解除了 [va, va + len) 的映射后调用 (vfree)
+ * 内核页表使用ASID 0, 所有CPU都可能缓存了它的表项 (只通知实际存在的hart)
+ */
+void uvm_flush_tlb_kernel(uint64 va, uint64 len)
+{
+    if (len > 0)
+        tlb_shootdown((1u << boot_info.ncpu) - 1, 0, va, len);
+}
+
+/*
+ * 当前进程修改了自己页表中 [va, va + len) 的映射后调用
+ * 其他页表(fork的子进程/exec还没有换上的新页表)还没有被使用过, 不需要刷新
+ */
+void uvm_flush_tlb(pgtbl_t pgtbl, uint64 va, uint64 len)
+{
+    proc_t *p = myproc();
+    if (p == NULL || p->pgtbl != pgtbl)
+        return;
+    uvm_flush_tlb_proc(p, va, len);
+}
+
+/* 输出每个CPU收发的TLB shootdown数量 (for debug) */
+void uvm_tlb_print_info()
+{
+    for (int i = 0; i < boot_info.ncpu; i++)
+        printf("cpu %d: tlb shootdown sent = %d, received = %d\n", i, tlb_ipi_sent[i], tlb_ipi_recv[i]);
+}
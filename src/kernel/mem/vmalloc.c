@@ -0,0 +1,135 @@
+#include "mod.h"
+
+/*
+ * vmalloc: 虚拟地址连续的内核内存 (设计见 type.h)
+ * 物理页来自内核池, 一页一页地分配, 不需要连续的大块
+ * 虚拟地址按首次适应分配, 已经分配的段组成按地址排序的链表
+ */
+
+static spinlock_t vmalloc_lk;   // 保护段链表和统计 (在kvm_lk之前获取)
+static vm_area_t *vm_areas;
+static kmem_cache_t *vm_area_cache;
+static uint32 vmalloc_pages;    // 已经映射的页面数
+static uint32 vmalloc_nr;       // 段的数量
+
+void vmalloc_init()
+{
+    spinlock_init(&vmalloc_lk, "vmalloc");
+    vm_area_cache = kmem_cache_create("vm_area", sizeof(vm_area_t));
+}
+
+/*
+ * 辅助：分配一段 npages 个页面加一个保护页的虚拟地址并挂进链表
+ * 调用者持有vmalloc_lk, 地址空间不够返回0
+ */
+static uint64 area_insert(vm_area_t *a, uint32 npages)
+{
+    uint64 need = (uint64)(npages + 1) * PGSIZE;
+    uint64 addr = VMALLOC_BASE;
+    vm_area_t **pp = &vm_areas;
+
+    for (; *pp != NULL; pp = &(*pp)->next) {
+        if ((*pp)->addr - addr >= need)
+            break;
+        addr = (*pp)->addr + (uint64)((*pp)->npages + 1) * PGSIZE;
+    }
+    if (addr + need > VMALLOC_END)
+        return 0;
+
+    a->addr = addr;
+    a->npages = npages;
+    a->next = *pp;
+    *pp = a;
+    return addr;
+}
+
+/*
+ * 分配 size 字节虚拟地址连续的内核内存 (按页取整, 内容全0)
+ * 失败返回NULL
+ */
+void *vmalloc(uint64 size)
+{
+    if (size == 0)
+        return NULL;
+    uint32 npages = ALIGN_UP(size, PGSIZE) / PGSIZE;
+
+    vm_area_t *a = kmem_cache_alloc(vm_area_cache);
+    if (a == NULL)
+        return NULL;
+    a->pages = kmalloc(npages * sizeof(uint64));
+    if (a->pages == NULL) {
+        kmem_cache_free(vm_area_cache, a);
+        return NULL;
+    }
+
+    // 物理页在锁外分配 (可能进入回收), 要不到就全部退回
+    uint32 got = 0;
+    for (; got < npages; got++) {
+        a->pages[got] = (uint64)pmem_alloc_flags(true, PMEM_ZEROED | PMEM_MAYFAIL);
+        if (a->pages[got] == 0)
+            break;
+    }
+
+    // 修改内核页表时还要持有kvm_lk: 和内核栈的映射可能共用中间的页表页
+    uint64 addr = 0;
+    if (got == npages) {
+        spinlock_acquire(&vmalloc_lk);
+        addr = area_insert(a, npages);
+        if (addr != 0) {
+            // 这段地址之前没有映射 (或者已经在vfree时刷新过), 只增加映射不需要刷新TLB
+            kvm_lock();
+            for (uint32 i = 0; i < npages; i++)
+                vm_mappages(NULL, addr + (uint64)i * PGSIZE, a->pages[i], PGSIZE, PTE_R | PTE_W);
+            kvm_unlock();
+            vmalloc_pages += npages;
+            vmalloc_nr++;
+        }
+        spinlock_release(&vmalloc_lk);
+    }
+
+    if (addr == 0) {
+        for (uint32 i = 0; i < got; i++)
+            pmem_free(a->pages[i], true);
+        kfree(a->pages);
+        kmem_cache_free(vm_area_cache, a);
+        return NULL;
+    }
+    return (void *)addr;
+}
+
+/* 释放 vmalloc 分配的内存, addr 必须是 vmalloc 的返回值 */
+void vfree(void *addr)
+{
+    if (addr == NULL)
+        return;
+
+    spinlock_acquire(&vmalloc_lk);
+    vm_area_t **pp = &vm_areas;
+    while (*pp != NULL && (*pp)->addr != (uint64)addr)
+        pp = &(*pp)->next;
+    vm_area_t *a = *pp;
+    if (a == NULL)
+        panic("vfree: not a vmalloc address");
+
+    // 先解除映射并刷新TLB, 才能释放物理页和这段地址
+    uint64 len = (uint64)a->npages * PGSIZE;
+    kvm_lock();
+    vm_unmappages(NULL, a->addr, len, false);
+    kvm_unlock();
+    uvm_flush_tlb_kernel(a->addr, len);
+    *pp = a->next;
+    vmalloc_pages -= a->npages;
+    vmalloc_nr--;
+    spinlock_release(&vmalloc_lk);
+
+    for (uint32 i = 0; i < a->npages; i++)
+        pmem_free(a->pages[i], true);
+    kfree(a->pages);
+    kmem_cache_free(vm_area_cache, a);
+}
+
+/* 输出vmalloc的使用情况 (for debug) */
+void vmalloc_print_info()
+{
+    printf("vmalloc: %d areas, %d pages\n", vmalloc_nr, vmalloc_pages);
+}
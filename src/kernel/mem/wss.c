@@ -0,0 +1,106 @@
+#include "mod.h"
+#include "../proc/mod.h"
+
+/*
+ * 工作集估计 (设计见 type.h)
+ * 扫描只发生在时钟中断返回用户态之前, 只修改当前进程的页表项, 不需要持有p->lk
+ * 直方图在一轮扫描结束时持有p->lk发布, 输出时持有p->lk读取
+ */
+
+// 一次扫描的结果
+typedef struct wss_batch {
+    uint32 n;
+    uint32 hist[WSS_NR_BUCKETS];
+    uint64 first, last;      // 清除了PTE_A的页表项覆盖的范围 (first > last 表示没有)
+    uint64 next;             // 扫满时下一个没有扫描的地址 (0表示扫完了整个地址空间)
+} wss_batch_t;
+
+// age所在的桶: 0, 1, 2-3, 4-7, 8-15, 16+
+static int age_bucket(uint8 age)
+{
+    int b = 0;
+    while (age != 0 && b < WSS_NR_BUCKETS - 1) {
+        age >>= 1;
+        b++;
+    }
+    return b;
+}
+
+// 辅助：采样并清除一个叶子页表项的访问位
+static void age_one(pte_t *pte, uint64 va, int level, void *arg)
+{
+    wss_batch_t *b = (wss_batch_t *)arg;
+
+    if (b->n == WSS_SCAN_PAGES) {
+        if (b->next == 0)
+            b->next = va;
+        return;
+    }
+    if (!(*pte & PTE_U))
+        return;
+    uint64 pa = PTE_TO_PA(*pte);
+    if (pa == pmem_zero_page())
+        return;
+    b->n++;
+
+    uint64 size = (uint64)PGSIZE << (9 * level);
+    page_t *pg = pmem_page(pa);
+    if (*pte & PTE_A) {
+        *pte &= ~PTE_A;
+        pg->age = 0;
+        if (b->first > b->last)
+            b->first = va;
+        b->last = va + size;
+    } else if (pg->age < WSS_AGE_MAX) {
+        pg->age++;
+    }
+    b->hist[age_bucket(pg->age)] += size / PGSIZE;
+}
+
+/* 从 p->wss_va 开始扫描当前进程的一批页表项, 更新页面的age和直方图 */
+void wss_scan()
+{
+    proc_t *p = myproc();
+    if (p == NULL || p->pgtbl == NULL)
+        return;
+
+    wss_batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.first = 1;
+    if (p->wss_va < USER_BASE || p->wss_va >= TRAPFRAME)
+        p->wss_va = USER_BASE;
+    vm_walk(p->pgtbl, p->wss_va, TRAPFRAME - p->wss_va, age_one, &b);
+    p->wss_va = b.next != 0 ? b.next : USER_BASE;
+
+    // TLB中残留的表项带着PTE_A, 不刷新的话之后的访问不会重新设置它
+    if (b.first < b.last)
+        uvm_flush_tlb(p->pgtbl, b.first, b.last - b.first);
+
+    for (int i = 0; i < WSS_NR_BUCKETS; i++)
+        p->wss_acc[i] += b.hist[i];
+    if (b.next == 0) {
+        spinlock_acquire(&p->lk);
+        for (int i = 0; i < WSS_NR_BUCKETS; i++)
+            p->wss_hist[i] = p->wss_acc[i];
+        p->wss_rounds++;
+        spinlock_release(&p->lk);
+        memset(p->wss_acc, 0, sizeof(p->wss_acc));
+    }
+}
+
+/* 输出每个进程上一轮扫描的页面空闲时间分布 (for debug) */
+void wss_print_info()
+{
+    printf("wss: idle rounds   0 / 1 / 2-3 / 4-7 / 8-15 / 16+ (pages)\n");
+    for (proc_t *q = proc_first(); q != NULL; q = q->next) {
+        spinlock_acquire(&q->lk);
+        if (q->state != UNUSED && q->pgtbl != NULL) {
+            uint32 *h = q->wss_hist;
+            printf("pid %d (%s): rounds = %d, hist = %d / %d / %d / %d / %d / %d\n",
+                   q->pid, q->name, q->wss_rounds, h[0], h[1], h[2], h[3], h[4], h[5]);
+            printf("    heap_top = %p, stack = %d pages, working set = %d pages\n",
+                   q->heap_top, (int)q->ustack_npage, h[0] + h[1]);
+        }
+        spinlock_release(&q->lk);
+    }
+}
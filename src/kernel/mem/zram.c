@@ -0,0 +1,180 @@
+#include "mod.h"
+
+/*
+ * 压缩交换层 (设计见 type.h)
+ * 只有换出页面的CPU会调用 zram_store (swap_out 保证同一时间只有一个), 所以压缩用的缓冲区是全局的
+ */
+
+static spinlock_t zram_lk;                 // 保护下面的链表、对象引用数和统计
+static zpage_t zram_partial[ZRAM_NR_CLASS]; // 每个类别还有空闲对象的页面链表的哨兵
+static uint32 zram_pages;                  // 压缩存储占用的页面数
+static uint32 zram_stored;                 // 存放的页面数
+static uint64 zram_bytes;                  // 压缩数据的总字节数
+
+// 统计信息
+static uint32 zram_stores;
+static uint32 zram_rejects;  // 压缩效果不好, 交给磁盘
+static uint32 zram_full;     // 压缩存储达到上限或者要不到页面
+static uint32 zram_hits;     // 换入时数据在zram中
+
+static uint8 zram_buf[ZRAM_MAX_OBJ];
+static uint16 zram_table[LZ4_HASH_SIZE];
+
+void zram_init()
+{
+    spinlock_init(&zram_lk, "zram");
+    for (int i = 0; i < ZRAM_NR_CLASS; i++)
+        zram_partial[i].next = zram_partial[i].prev = &zram_partial[i];
+}
+
+// 对象的大小 (包括zobj_t)
+static uint32 class_size(uint32 cls)
+{
+    return (cls + 1) * ZRAM_CLASS_STEP;
+}
+
+static void zpage_add(zpage_t *head, zpage_t *zp)
+{
+    zp->next = head->next;
+    zp->prev = head;
+    head->next->prev = zp;
+    head->next = zp;
+}
+
+static void zpage_del(zpage_t *zp)
+{
+    zp->prev->next = zp->next;
+    zp->next->prev = zp->prev;
+    zp->next = zp->prev = NULL;
+}
+
+/*
+ * 辅助：分配一个 cls 类别的对象, 需要时从用户池要一个新页面
+ * 调用者持有zram_lk, 失败返回NULL
+ */
+static zobj_t *zobj_alloc(uint32 cls)
+{
+    zpage_t *head = &zram_partial[cls];
+    zpage_t *zp = head->next;
+
+    if (zp == head) {
+        if (zram_pages >= ZRAM_MAX_PAGES)
+            return NULL;
+        zp = (zpage_t *)pmem_alloc_flags(false, PMEM_NORETRY);
+        if (zp == NULL)
+            return NULL;
+        zram_pages++;
+
+        uint32 size = class_size(cls);
+        uint32 first = ALIGN_UP(sizeof(zpage_t), 8);
+        zp->cls = cls;
+        zp->inuse = 0;
+        zp->free = NULL;
+        for (uint32 off = first + (PGSIZE - first) / size * size; off > first; ) {
+            off -= size;
+            zfree_t *f = (zfree_t *)((uint64)zp + off);
+            f->next = zp->free;
+            zp->free = f;
+        }
+        zpage_add(head, zp);
+    }
+
+    zfree_t *f = zp->free;
+    zp->free = f->next;
+    zp->inuse++;
+    if (zp->free == NULL)
+        zpage_del(zp);
+    return (zobj_t *)f;
+}
+
+// 辅助：释放一个对象, 页面空了就还给用户池 (调用者持有zram_lk)
+static void zobj_free(zobj_t *obj)
+{
+    zpage_t *zp = (zpage_t *)ALIGN_DOWN((uint64)obj, PGSIZE);
+    zfree_t *f = (zfree_t *)obj;
+
+    if (zp->free == NULL)
+        zpage_add(&zram_partial[zp->cls], zp);
+    f->next = zp->free;
+    zp->free = f;
+
+    if (--zp->inuse == 0) {
+        zpage_del(zp);
+        pmem_free((uint64)zp, false);
+        zram_pages--;
+    }
+}
+
+/*
+ * 压缩物理页 pa 并存起来, 返回它的槽位号 (引用数为1)
+ * 压缩效果不好或者存储已满返回SWAP_NONE, 调用者改为写磁盘
+ */
+uint32 zram_store(uint64 pa)
+{
+    uint32 len = lz4_compress((uint8 *)pa, PGSIZE, zram_buf, ZRAM_MAX_OBJ - sizeof(zobj_t), zram_table);
+    if (len == 0) {
+        zram_rejects++;
+        return SWAP_NONE;
+    }
+
+    uint32 cls = (len + sizeof(zobj_t) - 1) / ZRAM_CLASS_STEP;
+    spinlock_acquire(&zram_lk);
+    zobj_t *obj = zobj_alloc(cls);
+    if (obj == NULL) {
+        zram_full++;
+        spinlock_release(&zram_lk);
+        return SWAP_NONE;
+    }
+    obj->len = len;
+    obj->ref = 1;
+    zram_stored++;
+    zram_bytes += len;
+    zram_stores++;
+    spinlock_release(&zram_lk);
+
+    memcpy(obj + 1, zram_buf, len);
+    return ZRAM_SLOT(obj);
+}
+
+// 把槽位中的页面解压到物理页 pa (调用者的交换项还引用着它, 对象不会被释放)
+void zram_load(uint32 slot, uint64 pa)
+{
+    zobj_t *obj = ZRAM_OBJ(slot);
+    if (lz4_decompress((uint8 *)(obj + 1), obj->len, (uint8 *)pa, PGSIZE) != PGSIZE)
+        panic("zram_load: corrupted object");
+    zram_hits++;
+}
+
+// fork 时父子进程共享对象
+void zram_dup(uint32 slot)
+{
+    zobj_t *obj = ZRAM_OBJ(slot);
+    spinlock_acquire(&zram_lk);
+    if (obj->ref == 0xFFFF)
+        panic("zram_dup: too many references");
+    obj->ref++;
+    spinlock_release(&zram_lk);
+}
+
+// 释放一个引用, 归零时释放对象
+void zram_free(uint32 slot)
+{
+    zobj_t *obj = ZRAM_OBJ(slot);
+    spinlock_acquire(&zram_lk);
+    if (obj->ref == 0)
+        panic("zram_free: bad object");
+    if (--obj->ref == 0) {
+        zram_stored--;
+        zram_bytes -= obj->len;
+        zobj_free(obj);
+    }
+    spinlock_release(&zram_lk);
+}
+
+/* 输出压缩交换层的统计 (for debug) */
+void zram_print_info()
+{
+    printf("zram: stored = %d pages in %d/%d pages, compressed = %d KB\n",
+           zram_stored, zram_pages, ZRAM_MAX_PAGES, (uint32)(zram_bytes / 1024));
+    printf("zram: stores = %d, rejects = %d, full = %d, hits = %d\n", zram_stores, zram_rejects, zram_full, zram_hits);
+}
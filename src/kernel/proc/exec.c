@@ -62,7 +62,6 @@ static int uvm_alloc(pgtbl_t pgtbl, uint64 start, uint64 end, int perm) {
     for (; a < last; a += PGSIZE) {
         void *mem = pmem_alloc(false);
         if (mem == NULL) return -1;
-        memset(mem, 0, PGSIZE);
         
         // 映射物理页 (mem 被视为内核直接映射地址，即 PA)
         // vm_mappages 返回 void，出错会直接 panic，所以这里不检查返回值
@@ -81,7 +80,7 @@ static int load_segment(pgtbl_t pgtbl, uint64 va, inode_t *ip, uint32 offset, ui
         pte = vm_getpte(pgtbl, va + i, false);
         if (!pte || !(*pte & PTE_V)) return -1;
         
-        pa = PTE_TO_PA(*pte);
+        pa = PTE_TO_PA(*pte) + (va + i) % PGSIZE;
         n = PGSIZE - ((va + i) % PGSIZE);
         if (n > sz - i) n = sz - i;
 
@@ -109,7 +108,7 @@ static uint64 prepare_stack(pgtbl_t pgtbl, uint64 top, char **argv) {
         if (sp < top - USTACK_NPAGE * PGSIZE) return 0; // 栈溢出
         
         // 使用 copyout 将字符串拷贝到新栈
-        uvm_copyout(pgtbl, sp, (uint64)s, strlen(s) + 1);
+        if (uvm_copyout(pgtbl, sp, (uint64)s, strlen(s) + 1) < 0) return 0;
         stack[argc] = sp; // 记录字符串地址
     }
     stack[argc] = 0; // argv 结束符
@@ -119,7 +118,7 @@ static uint64 prepare_stack(pgtbl_t pgtbl, uint64 top, char **argv) {
     sp -= sp % 16;
     if (sp < top - USTACK_NPAGE * PGSIZE) return 0;
     
-    uvm_copyout(pgtbl, sp, (uint64)stack, (argc + 1) * sizeof(uint64));
+    if (uvm_copyout(pgtbl, sp, (uint64)stack, (argc + 1) * sizeof(uint64)) < 0) return 0;
     
     // 返回最终的栈顶 (也是 argv 数组的起始地址，即 a1 的值)
     return sp;
@@ -160,12 +159,14 @@ int proc_exec(char *path, char **argv) {
         if (ph.flags & ELF_PROG_FLAG_WRITE) perm |= PTE_W;
         if (ph.flags & ELF_PROG_FLAG_EXEC) perm |= PTE_X;
 
-        // 分配并映射内存
-        if (uvm_alloc(pgtbl, ph.vaddr, ph.vaddr + ph.memsz, perm) < 0) goto bad;
+        // 分配并映射内存: 文件里有内容的页面分配物理页, 后面完全属于BSS的页面映射零页
+        uint64 file_end = ALIGN_UP(ph.vaddr + ph.filesz, PGSIZE);
+        uint64 mem_end = ALIGN_UP(ph.vaddr + ph.memsz, PGSIZE);
+        if (uvm_alloc(pgtbl, ph.vaddr, file_end, perm) < 0) goto bad;
+        uvm_map_zero(pgtbl, file_end, mem_end - file_end, perm);
         
         // 记录最大的堆地址
-        uint64 end = ALIGN_UP(ph.vaddr + ph.memsz, PGSIZE);
-        if (end > sz) sz = end;
+        if (mem_end > sz) sz = mem_end;
         
         // 加载数据
         if (load_segment(pgtbl, ph.vaddr, ip, ph.off, ph.filesz) < 0) goto bad;
@@ -187,6 +188,7 @@ int proc_exec(char *path, char **argv) {
     if (sp == 0) goto bad;
 
     // Step 6-8: 提交更改
+    uvm_munmap_all();
     old_pgtbl = p->pgtbl;
     p->pgtbl = pgtbl;
     p->heap_top = stack_top; 
@@ -208,6 +210,9 @@ int proc_exec(char *path, char **argv) {
         if(*name == '/') last = name+1;
     memmove(p->name, last, sizeof(p->name));
 
+    // 新页表沿用进程的ASID, 先清掉旧页表留在TLB中的表项
+    uvm_flush_tlb(pgtbl, 0, VA_MAX);
+
     // 释放旧页表
     uvm_destroy_pgtbl(old_pgtbl);
     return 0;
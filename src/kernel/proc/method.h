@@ -5,6 +5,7 @@ void proc_init();
 pgtbl_t proc_pgtbl_init(uint64 tf_va);
 proc_t *proc_alloc();
 void proc_free(proc_t *p);
+proc_t *proc_first();
 void proc_make_first();
 int proc_fork();
 void proc_sched();
@@ -20,8 +20,14 @@ extern void fs_init();
 
 // --- 静态资源管理 ---
 
-// 进程池：所有进程控制块的仓库
-static proc_t proc_pool[N_PROC];
+// 进程池：所有进程控制块组成的链表
+// 进程控制块由 proc_cache 分配后挂到链表尾部且永不释放, 变为 UNUSED 后由 proc_alloc 复用
+// 这样调度器等遍历者不需要持有全局锁
+static proc_t *proc_list;
+static proc_t **proc_list_tail = &proc_list;
+static int nr_proc;               // 已创建的进程控制块数量 (也是下一个内核栈的编号)
+static spinlock_t proc_list_lock; // 保护上面两个变量和链表的追加
+static kmem_cache_t *proc_cache;
 // 指向首个用户进程（通常是 init）
 static proc_t *init_process;
 
@@ -54,6 +60,7 @@ static void proc_entry_point()
     // [NEW] 如果是第一个进程(PID=1)，负责初始化文件系统
     if (p->pid == 1) {
         fs_init();
+        swap_init();
         
         // LAB-9: 只有 PID 1 (init) 需要手动打开标准流
         // 因为它是所有其他进程的祖先，其他进程会通过 fork 继承这些文件描述符
@@ -74,20 +81,38 @@ void proc_init()
 {
     spinlock_init(&pid_lock, "pid_allocator");
     spinlock_init(&lifecycle_lock, "proc_lifecycle");
-    
-    // 初始化进程池
-    for (int i = 0; i < N_PROC; i++) {
-        spinlock_init(&proc_pool[i].lk, "proc_lock");
-        proc_pool[i].state = UNUSED;
-        // 预先计算好每个进程的内核栈基址
-        proc_pool[i].kstack = KSTACK(i);
-
-        // LAB-9: 初始化文件系统相关字段
-        proc_pool[i].cwd = NULL;
-        for(int j = 0; j < N_OPEN_FILE; j++) {
-            proc_pool[i].open_file[j] = NULL;
-        }
-    }
+    spinlock_init(&proc_list_lock, "proc_list");
+
+    // 进程控制块按需从 slab 分配
+    proc_cache = kmem_cache_create("proc", sizeof(proc_t));
+}
+
+// 创建一个新的进程控制块并挂到进程链表上 (返回时持有 p->lk)
+static proc_t *proc_create()
+{
+    proc_t *p = kmem_cache_alloc(proc_cache);
+    memset(p, 0, sizeof(proc_t));
+    spinlock_init(&p->lk, "proc_lock");
+    p->state = UNUSED;
+
+    spinlock_acquire(&proc_list_lock);
+    int id = nr_proc++;
+    spinlock_release(&proc_list_lock);
+
+    // 计算并映射该进程的内核栈
+    p->kstack = KSTACK(id);
+    kvm_map_kstack(p->kstack);
+
+    spinlock_acquire(&p->lk);
+
+    // 初始化完成后才对其他CPU可见
+    __sync_synchronize();
+    spinlock_acquire(&proc_list_lock);
+    *proc_list_tail = p;
+    proc_list_tail = &p->next;
+    spinlock_release(&proc_list_lock);
+
+    return p;
 }
 
 // 初始化进程页表
@@ -95,9 +120,9 @@ pgtbl_t proc_pgtbl_init(uint64 tf_va)
 {
     pgtbl_t tbl = (pgtbl_t)pmem_alloc(true);
     if (!tbl) return NULL;
-    memset(tbl, 0, PGSIZE);
 
     vm_mappages(tbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+    // trapframe 独占一个物理页: 映射的整页中不能有其他进程或内核的数据
     vm_mappages(tbl, TRAPFRAME, tf_va, PGSIZE, PTE_R | PTE_W);
 
     return tbl;
@@ -106,27 +131,22 @@ pgtbl_t proc_pgtbl_init(uint64 tf_va)
 // 申请一个空闲进程块
 proc_t *proc_alloc()
 {
-    proc_t *p = NULL;
+    proc_t *p;
 
-    for (int i = 0; i < N_PROC; i++) {
-        spinlock_acquire(&proc_pool[i].lk);
-        if (proc_pool[i].state == UNUSED) {
-            p = &proc_pool[i];
+    // 优先复用已经退出的进程控制块
+    for (p = proc_list; p != NULL; p = p->next) {
+        spinlock_acquire(&p->lk);
+        if (p->state == UNUSED)
             break;
-        }
-        spinlock_release(&proc_pool[i].lk);
+        spinlock_release(&p->lk);
     }
 
-    if (!p) return NULL;
+    if (!p) p = proc_create();
 
     p->pid = allocate_pid();
     p->state = UNUSED; 
 
-    if ((p->tf = (trapframe_t *)pmem_alloc(true)) == NULL) {
-        spinlock_release(&p->lk);
-        return NULL;
-    }
-    memset(p->tf, 0, PGSIZE);
+    p->tf = pmem_alloc_flags(true, PMEM_ZEROED);
 
     if ((p->pgtbl = proc_pgtbl_init((uint64)p->tf)) == NULL) {
         pmem_free((uint64)p->tf, true);
@@ -143,9 +163,19 @@ proc_t *proc_alloc()
     p->parent = NULL;
     p->exit_code = 0;
     p->sleep_space = NULL;
+    p->user_preempted = false;
+    p->nsleeplock = 0;
+    p->ksm_va = USER_BASE;
+    p->wss_va = USER_BASE;
+    p->wss_rounds = 0;
+    memset(p->wss_acc, 0, sizeof(p->wss_acc));
+    memset(p->wss_hist, 0, sizeof(p->wss_hist));
     p->heap_top = 0;
     p->ustack_npage = 0;
     p->mmap = NULL;
+    p->mmap_tree = NULL;
+    p->asid_gen = 0;
+    p->cpu_mask = 0;
     memset(p->name, 0, sizeof(p->name));
 
     // LAB-9: 确保分配时清理文件字段
@@ -176,24 +206,17 @@ void proc_free(proc_t *p)
     p->tf = NULL;
 
     if (p->pgtbl) {
-        vm_unmappages(p->pgtbl, USER_BASE, PGSIZE, true);
-        if (p->heap_top > USER_BASE + PGSIZE)
-             vm_unmappages(p->pgtbl, USER_BASE + PGSIZE, p->heap_top - (USER_BASE + PGSIZE), true);
-        if (p->ustack_npage > 0)
-            vm_unmappages(p->pgtbl, TRAPFRAME - p->ustack_npage * PGSIZE, p->ustack_npage * PGSIZE, true);
-        
+        // 一次遍历整个页表: 释放所有用户页面和页表页
+        uvm_destroy_pgtbl(p->pgtbl);
+
         mmap_region_t *m = p->mmap;
         while (m) {
-            vm_unmappages(p->pgtbl, m->begin, m->npages * PGSIZE, true);
             mmap_region_t *next = m->next;
             mmap_region_free(m);
             m = next;
         }
         p->mmap = NULL;
-        
-        vm_unmappages(p->pgtbl, TRAMPOLINE, PGSIZE, false);
-        vm_unmappages(p->pgtbl, TRAPFRAME, PGSIZE, false);
-        pmem_free((uint64)p->pgtbl, true);
+        p->mmap_tree = NULL;
     }
     p->pgtbl = NULL;
     p->pid = 0;
@@ -253,7 +276,13 @@ int proc_fork()
         mmap_region_t *new_node = mmap_region_alloc();
         new_node->begin = src->begin;
         new_node->npages = src->npages;
+        new_node->perm = src->perm;
+        new_node->flags = src->flags;
+        new_node->ip = src->ip ? inode_dup(src->ip) : NULL;
+        new_node->offset = src->offset;
+        new_node->advice = src->advice;
         new_node->next = NULL;
+        mmap_tree_insert(&child->mmap_tree, new_node);
         *dst = new_node;
         dst = &new_node->next;
         src = src->next;
@@ -283,6 +312,12 @@ int proc_fork()
     return pid;
 }
 
+// 进程链表的第一个进程控制块 (链表只追加, 遍历时不需要加锁)
+proc_t *proc_first()
+{
+    return proc_list;
+}
+
 void proc_sched()
 {
     swtch(&myproc()->ctx, &mycpu()->ctx);
@@ -299,8 +334,7 @@ void proc_yield()
 
 void proc_wakeup(void *chan)
 {
-    for (int i = 0; i < N_PROC; i++) {
-        proc_t *p = &proc_pool[i];
+    for (proc_t *p = proc_list; p != NULL; p = p->next) {
         if (p != myproc()) {
             spinlock_acquire(&p->lk);
             if (p->state == SLEEPING && p->sleep_space == chan) {
@@ -334,10 +368,11 @@ void proc_scheduler()
 
     for (;;) {
         intr_on();
-        for (int i = 0; i < N_PROC; i++) {
-            proc_t *p = &proc_pool[i];
+        bool found = false;
+        for (proc_t *p = proc_list; p != NULL; p = p->next) {
             spinlock_acquire(&p->lk);
             if (p->state == RUNNABLE) {
+                found = true;
                 p->state = RUNNING;
                 c->proc = p;
                 #if SCHED_TRACE
@@ -348,6 +383,12 @@ void proc_scheduler()
             }
             spinlock_release(&p->lk);
         }
+
+        // 一轮下来没有可运行的进程: 利用空闲时间回收缓存和预清零物理页
+        if (!found) {
+            pmem_reclaim_idle();
+            pmem_zero_idle();
+        }
     }
 }
 
@@ -356,16 +397,19 @@ void proc_exit(int code)
     proc_t *curr = myproc();
     if (curr == init_process) panic("init process exiting");
 
+    // 写回共享文件映射需要睡眠, 不能留给持有p->lk的proc_free
+    uvm_munmap_all();
+
     spinlock_acquire(&lifecycle_lock);
 
-    for (int i = 0; i < N_PROC; i++) {
-        if (proc_pool[i].parent == curr) {
-            proc_pool[i].parent = init_process;
-            spinlock_acquire(&proc_pool[i].lk);
-            if (proc_pool[i].state == ZOMBIE) {
+    for (proc_t *p = proc_list; p != NULL; p = p->next) {
+        if (p->parent == curr) {
+            p->parent = init_process;
+            spinlock_acquire(&p->lk);
+            if (p->state == ZOMBIE) {
                  proc_wakeup(init_process); 
             }
-            spinlock_release(&proc_pool[i].lk);
+            spinlock_release(&p->lk);
         }
     }
 
@@ -389,8 +433,7 @@ int proc_wait(uint64 addr)
         int have_kids = 0;
         proc_t *curr = myproc();
 
-        for (int i = 0; i < N_PROC; i++) {
-            proc_t *p = &proc_pool[i];
+        for (proc_t *p = proc_list; p != NULL; p = p->next) {
             if (p->parent != curr) continue;
             
             have_kids = 1;
@@ -401,9 +444,8 @@ int proc_wait(uint64 addr)
                 printf("proc %d is wakeup!\n", curr->pid);
                 proc_free(p); 
                 spinlock_release(&lifecycle_lock);
-                if (addr != 0) {
-                    uvm_copyout(curr->pgtbl, addr, (uint64)&code, sizeof(int));
-                }
+                if (addr != 0 && uvm_copyout(curr->pgtbl, addr, (uint64)&code, sizeof(int)) < 0)
+                    return -1;
                 return pid;
             }
             spinlock_release(&p->lk);
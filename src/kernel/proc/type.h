@@ -71,12 +71,17 @@ typedef struct trapframe
     /* 264 */ uint64 t4;
     /* 272 */ uint64 t5;
     /* 280 */ uint64 t6;
+
+    /* 288 */ uint64 user_to_kern_flush;     // 非0: 进入内核切换页表后需要刷新整个TLB (不使用ASID时)
 } trapframe_t;
 
 // 外部结构体
 typedef uint64 *pgtbl_t;
 typedef struct mmap_region mmap_region_t;
 
+// 工作集直方图的桶数 (见 mem/type.h 工作集估计)
+#define WSS_NR_BUCKETS 6
+
 enum proc_state
 {
     UNUSED,   // 未被使用
@@ -97,11 +102,22 @@ typedef struct proc
     struct proc *parent;   // 父进程
     int exit_code;         // 进程退出状态(父进程关心)
     void *sleep_space;     // 进程睡眠位置(等待的资源)
+    bool user_preempted;   // 在用户态被时钟中断抢占 (此时其他CPU可以换出它的页面, 见swap.c)
+    int nsleeplock;        // 持有的睡眠锁数量 (持锁时拷贝用户数据不能触发缺页, 见uvm.c)
 
     pgtbl_t pgtbl;       // 用户态页表
+    uint32 asid;         // 用户态页表的ASID (见uvm_activate)
+    uint64 asid_gen;     // asid所属的代, 与全局的代不同时需要重新分配
+    uint32 cpu_mask;     // TLB中可能有这个ASID表项的CPU (bit i对应CPU i, 没有使用ASID时为0)
     uint64 heap_top;     // 用户堆顶(以字节为单位)
     uint64 ustack_npage; // 用户栈占用的页面数量
-    mmap_region_t *mmap; // 用户态mmap区域
+    mmap_region_t *mmap; // 用户态mmap区域 (按地址排序的链表)
+    mmap_region_t *mmap_tree; // 同一批mmap区域组成的AVL树
+    uint64 ksm_va;       // 同页合并扫描到的位置 (见ksm.c)
+    uint64 wss_va;       // 工作集扫描到的位置 (见wss.c)
+    uint32 wss_rounds;   // 完整扫描的轮数
+    uint32 wss_acc[WSS_NR_BUCKETS];  // 本轮扫描累计的页面空闲时间分布
+    uint32 wss_hist[WSS_NR_BUCKETS]; // 上一轮完整扫描的分布 (由p->lk保护)
     trapframe_t *tf;     // 用户态内核态切换时的运行环境暂存空间
 
     // Lab 9 新增字段
@@ -110,6 +126,6 @@ typedef struct proc
 
     uint64 kstack;       // 内核栈的虚拟地址
     context_t ctx;       // 内核态进程上下文
-} proc_t;
 
-#define N_PROC 32
\ No newline at end of file
+    struct proc *next;   // 所有进程控制块组成的链表 (只追加, 不删除)
+} proc_t;
\ No newline at end of file
@@ -15,6 +15,7 @@ int arg_addr(int n, uint64 *ip);
 uint64 sys_brk();
 uint64 sys_mmap();
 uint64 sys_munmap();
+uint64 sys_msync();
 uint64 sys_print_str();
 uint64 sys_print_int();
 uint64 sys_fork();
@@ -48,4 +49,16 @@ uint64 sys_chdir();
 uint64 sys_print_cwd();
 uint64 sys_link();
 uint64 sys_unlink();
-uint64 sys_exec();
\ No newline at end of file
+uint64 sys_exec();
+
+// 性能测试
+uint64 sys_pmem_bench();
+uint64 sys_show_pmem();
+uint64 sys_show_kmem();
+uint64 sys_yield();
+uint64 sys_uptime();
+uint64 sys_asid_ctl();
+uint64 sys_mem_bench();
+uint64 sys_show_tlb();
+uint64 sys_madvise();
+uint64 sys_show_wss();
\ No newline at end of file
@@ -38,6 +38,18 @@ static uint64 (*syscalls[])(void) = {
     [SYS_link] sys_link,
     [SYS_unlink] sys_unlink,
     [SYS_exec] sys_exec,
+    // 性能测试
+    [SYS_pmem_bench] sys_pmem_bench,
+    [SYS_show_pmem] sys_show_pmem,
+    [SYS_show_kmem] sys_show_kmem,
+    [SYS_yield] sys_yield,
+    [SYS_uptime] sys_uptime,
+    [SYS_asid_ctl] sys_asid_ctl,
+    [SYS_msync] sys_msync,
+    [SYS_mem_bench] sys_mem_bench,
+    [SYS_show_tlb] sys_show_tlb,
+    [SYS_madvise] sys_madvise,
+    [SYS_show_wss] sys_show_wss,
 };
 
 // 基于系统调用表的请求跳转
@@ -81,8 +93,7 @@ int arg_str(int n, char *buf, int maxlen) {
     proc_t *p = myproc();
     uint64 addr;
     arg_uint64(n, &addr);
-    uvm_copyin_str(p->pgtbl, (uint64)buf, addr, maxlen);
-    return 0;
+    return uvm_copyin_str(p->pgtbl, (uint64)buf, addr, maxlen);
 }
 
 // 兼容 wrapper，供 sysfunc.c 使用
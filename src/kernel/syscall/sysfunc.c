@@ -2,6 +2,7 @@
 
 #define MAX_PATH 128
 #define MAX_ARG  32
+#define MAX_ARG_SIZE (8 * PGSIZE) // exec参数字符串的总长度上限
 
 // -------------------------------------------------------------------
 // Lab 1-4: 基础/测试系统调用 (补充缺失部分)
@@ -46,10 +47,29 @@ uint64 sys_mmap(void) {
     uint32 len, prot, flags;
     if (arg_addr(0, &addr) < 0 || arg_int(1, (int*)&len) < 0 || 
         arg_int(2, (int*)&prot) < 0 || arg_int(3, (int*)&flags) < 0) return -1;
-    
+
+    // prot 直接进入页表项: 用户只能给出读写执行权限, PTE_U 由内核加上
+    // (PTE_G 会让表项不受按ASID刷新的影响, PTE_COW/PTE_SWAP 是内核自己的标记)
+    if (prot == 0 || (prot & ~(PTE_R | PTE_W | PTE_X)) != 0) return -1;
+    prot |= PTE_U;
+
     uint32 npages = (len + PGSIZE - 1) / PGSIZE;
-    uvm_mmap(addr, npages, prot);
-    return addr; 
+
+    // 文件映射: 第5/6个参数是文件描述符和文件偏移
+    inode_t *ip = NULL;
+    uint32 offset = 0;
+    if (flags & MAP_FILE) {
+        int fd;
+        if (arg_int(4, &fd) < 0) return -1;
+        arg_uint32(5, &offset);
+        if (offset % PGSIZE != 0) return -1;
+        if (fd < 0 || fd >= N_OPEN_FILE || myproc()->open_file[fd] == NULL) return -1;
+        file_t *f = myproc()->open_file[fd];
+        if (!f->readable || f->ip->disk_info.type != INODE_TYPE_DATA) return -1;
+        if ((flags & MAP_SHARED) && (prot & PTE_W) && !f->writable) return -1;
+        ip = f->ip;
+    }
+    return uvm_mmap(addr, npages, prot, flags, ip, offset);
 }
 
 uint64 sys_munmap(void) {
@@ -58,10 +78,31 @@ uint64 sys_munmap(void) {
     if (arg_addr(0, &addr) < 0 || arg_int(1, (int*)&len) < 0) return -1;
     
     uint32 npages = (len + PGSIZE - 1) / PGSIZE;
-    uvm_munmap(addr, npages);
+    return uvm_munmap(addr, npages);
+}
+
+// msync(addr, len): 把共享文件映射中修改过的页面写回文件
+uint64 sys_msync(void) {
+    uint64 addr;
+    uint32 len;
+    if (arg_addr(0, &addr) < 0 || arg_int(1, (int*)&len) < 0) return -1;
+
+    uint32 npages = (len + PGSIZE - 1) / PGSIZE;
+    uvm_msync(addr, npages);
     return 0;
 }
 
+uint64 sys_madvise(void) {
+    uint64 addr;
+    uint32 len;
+    int advice;
+    if (arg_addr(0, &addr) < 0 || arg_int(1, (int*)&len) < 0 || arg_int(2, &advice) < 0) return -1;
+    if (addr % PGSIZE != 0) return -1;
+
+    uint32 npages = (len + PGSIZE - 1) / PGSIZE;
+    return uvm_madvise(addr, npages, advice);
+}
+
 uint64 sys_fork(void) {
     return proc_fork();
 }
@@ -136,11 +177,16 @@ uint64 sys_read_block() {
     arg_int(0, &block_num);
     arg_addr(1, &user_dst);
     
+    // 持有缓冲区的睡眠锁时不能访问用户地址 (可能缺页), 经过内核缓冲区中转
+    char *bounce = kmalloc(BLOCK_SIZE);
+    if (bounce == NULL) return -1;
     buffer_t *b = buffer_get(block_num);
-    // 拷贝数据到用户空间
-    uvm_copyout(myproc()->pgtbl, user_dst, (uint64)b->data, BLOCK_SIZE);
+    memmove(bounce, b->data, BLOCK_SIZE);
     buffer_put(b);
-    return 0;
+    // 拷贝数据到用户空间
+    int ret = uvm_copyout(myproc()->pgtbl, user_dst, (uint64)bounce, BLOCK_SIZE);
+    kfree(bounce);
+    return ret;
 }
 
 uint64 sys_write_block() {
@@ -148,11 +194,18 @@ uint64 sys_write_block() {
     arg_int(0, &block_num);
     arg_addr(1, &user_src);
     
+    // 从用户空间拷贝数据 (先于buffer_get, 理由同上)
+    char *bounce = kmalloc(BLOCK_SIZE);
+    if (bounce == NULL) return -1;
+    if (uvm_copyin(myproc()->pgtbl, (uint64)bounce, user_src, BLOCK_SIZE) < 0) {
+        kfree(bounce);
+        return -1;
+    }
     buffer_t *b = buffer_get(block_num);
-    // 从用户空间拷贝数据
-    uvm_copyin(myproc()->pgtbl, (uint64)b->data, user_src, BLOCK_SIZE);
+    memmove(b->data, bounce, BLOCK_SIZE);
     buffer_write(b); // 标记写回
     buffer_put(b);
+    kfree(bounce);
     return 0;
 }
 
@@ -186,24 +239,48 @@ uint64 sys_exec(void) {
     
     if (arg_str(0, path, MAX_PATH) < 0 || arg_addr(1, &argv_ptr) < 0) return -1;
 
+    // 所有参数字符串首尾相接地放在一块kmalloc缓冲区里
+    // 从一页开始, 放不下时加倍 (最多MAX_ARG_SIZE), 常见的短参数不需要多页也不需要改内核页表
+    uint32 cap = PGSIZE;
+    char *buf = kmalloc(cap);
+    if (buf == NULL) return -1;
+
+    int ret = -1;
+    uint32 used = 0;
     for (int i = 0; i < MAX_ARG; i++) {
         uint64 u_arg;
-        uvm_copyin(myproc()->pgtbl, (uint64)&u_arg, argv_ptr + i * sizeof(uint64), sizeof(uint64));
-        
-        if (u_arg == 0) {
-            argv[i] = 0;
+        argv[i] = 0;
+        if (uvm_copyin(myproc()->pgtbl, (uint64)&u_arg, argv_ptr + i * sizeof(uint64), sizeof(uint64)) < 0)
+            goto out;
+
+        if (u_arg == 0)
             break;
+        for (;;) {
+            if (uvm_copyin_str(myproc()->pgtbl, (uint64)(buf + used), u_arg, cap - used) < 0)
+                goto out;
+            // 结尾的'\0'之后还有空间, 说明没有被截断
+            if (used + strlen(buf + used) + 1 < cap)
+                break;
+            if (cap >= MAX_ARG_SIZE)
+                goto out;
+            char *bigger = kmalloc(cap * 2);
+            if (bigger == NULL)
+                goto out;
+            memcpy(bigger, buf, used);
+            for (int j = 0; j < i; j++)
+                argv[j] = bigger + (argv[j] - buf);
+            kfree(buf);
+            buf = bigger;
+            cap *= 2;
         }
-        argv[i] = (char*)pmem_alloc(false);
-        uvm_copyin_str(myproc()->pgtbl, (uint64)argv[i], u_arg, PGSIZE);
+        argv[i] = buf + used;
+        used += strlen(argv[i]) + 1;
     }
 
-    int ret = proc_exec(path, argv);
-
-    for (int i = 0; i < MAX_ARG && argv[i] != 0; i++) {
-        pmem_free((uint64)argv[i], false);
-    }
+    ret = proc_exec(path, argv);
 
+out:
+    kfree(buf);
     return ret;
 }
 
@@ -348,4 +425,72 @@ uint64 sys_unlink(void) {
     char path[MAX_PATH];
     if (arg_str(0, path, MAX_PATH) < 0) return -1;
     return path_unlink(path);
-}
\ No newline at end of file
+}
+
+// -------------------------------------------------------------------
+// 性能测试
+// -------------------------------------------------------------------
+
+// pmem_bench(rounds, in_kernel): 返回本CPU完成测试消耗的时钟周期
+uint64 sys_pmem_bench(void) {
+    uint32 rounds;
+    int in_kernel;
+    if (arg_int(0, (int*)&rounds) < 0 || arg_int(1, &in_kernel) < 0) return -1;
+    return pmem_bench(rounds, in_kernel ? true : false);
+}
+
+// 输出物理内存每一阶的空闲块数量
+uint64 sys_show_pmem(void) {
+    pmem_print_info();
+    uvm_thp_print_info();
+    swap_print_info();
+    ksm_print_info();
+    return 0;
+}
+
+// 输出slab分配器各个cache和vmalloc的使用情况
+uint64 sys_show_kmem(void) {
+    kmem_print_info();
+    vmalloc_print_info();
+    return 0;
+}
+
+// 主动让出CPU
+uint64 sys_yield(void) {
+    proc_yield();
+    return 0;
+}
+
+// 返回time寄存器的值
+uint64 sys_uptime(void) {
+    return r_time();
+}
+
+// asid_ctl(enable): 打开或关闭ASID, 返回之前的状态
+uint64 sys_asid_ctl(void) {
+    int enable;
+    if (arg_int(0, &enable) < 0) return -1;
+    return uvm_asid_enable(enable ? true : false);
+}
+
+// mem_bench(op, impl, size, rounds): 返回完成测试消耗的时钟周期, 不支持的组合返回0
+uint64 sys_mem_bench(void) {
+    int op, impl;
+    uint32 size, rounds;
+    if (arg_int(0, &op) < 0 || arg_int(1, &impl) < 0) return -1;
+    arg_uint32(2, &size);
+    arg_uint32(3, &rounds);
+    return mem_bench(op, impl, size, rounds);
+}
+
+// 输出每个CPU收发的TLB shootdown数量
+uint64 sys_show_tlb(void) {
+    uvm_tlb_print_info();
+    return 0;
+}
+
+// 输出每个进程的工作集估计
+uint64 sys_show_wss(void) {
+    wss_print_info();
+    return 0;
+}
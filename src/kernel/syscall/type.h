@@ -41,8 +41,23 @@
 #define SYS_unlink 34
 #define SYS_exec 35
 
+// 性能测试
+#define SYS_pmem_bench 36   // 物理页分配器吞吐量测试 (返回消耗的时钟周期)
+#define SYS_show_pmem 37    // 输出伙伴系统的碎片化报告
+#define SYS_show_kmem 38    // 输出slab分配器各个cache的使用情况
+#define SYS_yield 39        // 主动让出CPU
+#define SYS_uptime 40       // 读取time寄存器 (时钟周期)
+#define SYS_asid_ctl 41     // 打开/关闭ASID (返回之前的状态)
+
+#define SYS_msync 42        // 把共享文件映射的脏页写回文件
+
+#define SYS_mem_bench 43    // memset/memcpy/memmove吞吐量测试 (返回消耗的时钟周期)
+#define SYS_show_tlb 44     // 输出每个CPU收发的TLB shootdown数量
+#define SYS_madvise 45      // 对mmap区域给出访问模式提示 (MADV_*)
+#define SYS_show_wss 46     // 输出每个进程的页面空闲时间分布 (工作集估计)
+
 // [修复] 更新最大系统调用号
-#define SYS_MAX_NUM 35
+#define SYS_MAX_NUM 46
 
 /* 可以传入的最大字符串长度 */
 #define STR_MAXLEN 127
\ No newline at end of file
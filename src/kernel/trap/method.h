@@ -14,6 +14,7 @@ void timer_create();           // 时钟创建
 void timer_update();           // 时钟更新(ticks++)
 uint64 timer_get_ticks();      // 获取时钟的tick
 void timer_wait(uint64 ntick); // 等待ntick
+void ipi_send(int cpuid);      // 向其他CPU发送核间中断
 
 // trap的初始化和处理逻辑
 
@@ -26,4 +27,5 @@ void trap_user_return();
 // 辅助函数: 外设中断和时钟中断处理
 
 void external_interrupt_handler();
-void timer_interrupt_handler();
\ No newline at end of file
+void timer_interrupt_handler();
+bool soft_interrupt_handler();
\ No newline at end of file
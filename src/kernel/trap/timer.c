@@ -12,7 +12,8 @@ extern void timer_vector();
 
 // 每个 CPU 核心在 M-mode 中断处理时需要的临时存储区
 // 保存: [0-2] 临时寄存器, [3] mtimecmp 地址, [4] interval 间隔
-static uint64 timer_scratch_pad[NCPU][5];
+//       [5] 时钟中断挂起标志 (M-mode置1, S-mode取走), [6] msip 地址
+static uint64 timer_scratch_pad[NCPU][7];
 
 void timer_init()
 {
@@ -29,6 +30,8 @@ void timer_init()
     uint64 *scratch = timer_scratch_pad[cpuid];
     scratch[3] = (uint64)mtimecmp_reg;
     scratch[4] = INTERVAL;
+    scratch[5] = 0;
+    scratch[6] = CLINT_MSIP(cpuid);
 
     // 4. 将 scratch 地址写入 mscratch 寄存器
     w_mscratch((uint64)scratch);
@@ -36,9 +39,20 @@ void timer_init()
     // 5. 设置 M-mode 异常向量表地址
     w_mtvec((uint64)timer_vector);
 
-    // 6. 开启 M-mode 全局中断和时钟中断
+    // 6. 开启 M-mode 全局中断、时钟中断和软件中断(IPI)
     w_mstatus(r_mstatus() | MSTATUS_MIE);
-    w_mie(r_mie() | MIE_MTIE);
+    w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+/*
+ * 向另一个CPU发送核间中断 (IPI)
+ * 写目标CPU的msip引发它的M-mode软件中断, timer_vector再把它转成S-mode软件中断
+ * 要传递的内容由调用者事先放在目标CPU能看到的地方 (比如TLB刷新的邮箱)
+ */
+void ipi_send(int cpuid)
+{
+    __sync_synchronize();
+    *(volatile uint32 *)CLINT_MSIP(cpuid) = 1;
 }
 
 /* -------------------------------------------------------------------------
@@ -73,6 +87,25 @@ void timer_update()
     proc_wakeup(&time_keeper);
 }
 
+/*
+ * 处理S-mode软件中断
+ * M-mode的时钟中断和IPI都会变成S-mode软件中断, 先清除挂起位再检查各自的来源
+ * 返回这次是否有时钟中断 (调用者据此决定是否让出CPU)
+ */
+bool soft_interrupt_handler()
+{
+    w_sip(r_sip() & ~2);
+
+    // 其他CPU发来的TLB刷新请求
+    uvm_tlb_ipi();
+
+    // 原子地取走M-mode留下的时钟中断标志
+    if (__sync_lock_test_and_set(&timer_scratch_pad[mycpuid()][5], 0) == 0)
+        return false;
+    timer_interrupt_handler();
+    return true;
+}
+
 // 获取当前系统时间
 uint64 timer_get_ticks()
 {
@@ -48,6 +48,8 @@ void trap_kernel_init()
 {
     plic_init();
     timer_create();
+    // 关中断等锁的CPU也要应答TLB刷新请求 (见 soft_interrupt_handler)
+    spinlock_set_poll(uvm_tlb_ipi);
 }
 
 void trap_kernel_inithart()
@@ -76,12 +78,13 @@ void trap_kernel_handler()
 
     int irq_type = scause_val & 0xf;
     int is_async = (scause_val & 0x8000000000000000ul) != 0;
+    bool tick = false;
 
     if (is_async) {
         // --- 中断处理 ---
         switch (irq_type) {
-        case 1: // S 态软件中断（实际上由 M 态时钟中断转发而来）
-            timer_interrupt_handler();
+        case 1: // S 态软件中断（由 M 态时钟中断或其他CPU的IPI转发而来）
+            tick = soft_interrupt_handler();
             break;
         case 9: // S 态外部中断（外设）
             external_interrupt_handler();
@@ -100,7 +103,7 @@ void trap_kernel_handler()
 
     // 抢占式调度点：
     // 如果是时钟中断，且当前有进程正在运行（而非调度器或空闲线程），则让出 CPU
-    if (is_async && irq_type == 1) {
+    if (tick) {
         if (myproc() != NULL && myproc()->state == RUNNING) {
             proc_yield();
         }
@@ -139,8 +142,4 @@ void timer_interrupt_handler()
     if (mycpuid() == 0) {
         timer_update();
     }
-
-    // 清除 SIP 寄存器中的软件中断挂起位
-    // 告知硬件该中断已被处理
-    w_sip(r_sip() & ~2);
 }
\ No newline at end of file
@@ -15,6 +15,32 @@ extern char kernel_vector[];
 extern char *interrupt_info[16];
 extern char *exception_info[16];
 
+// 缺页时按需分配堆/mmap页面
+// 文件映射的页面可能要从磁盘读入, 等待期间需要打开中断 (和系统调用一样)
+static int lazy_fault(proc_t *p, uint64 va, bool write)
+{
+    intr_on();
+    int ret = uvm_lazy_fault(p->pgtbl, p->heap_top, p->mmap_tree, va, write);
+    intr_off();
+    return ret;
+}
+
+// 写入写时复制页面: 拷贝一个页面, 分配时可能进入回收, 还要刷新TLB, 同样打开中断
+static int cow_fault(proc_t *p, uint64 va)
+{
+    intr_on();
+    int ret = uvm_cow_fault(p->pgtbl, va);
+    intr_off();
+    return ret;
+}
+
+// 终止当前进程: 和exit一样先解除所有mmap区域(写回共享文件映射, 需要睡眠), 再通知父进程
+static void kill_current()
+{
+    intr_on();
+    proc_exit(-1);
+}
+
 // 用户态陷阱处理的核心入口
 // 由 user_vector 在保存完上下文后跳转至此
 void trap_user_handler()
@@ -38,12 +64,13 @@ void trap_user_handler()
     uint64 scause_reg = r_scause();
     int cause_type = scause_reg & 0xf;
     bool is_interrupt = (scause_reg & 0x8000000000000000ul) != 0;
+    bool tick = false;
 
     if (is_interrupt) {
         // --- 处理中断 ---
         switch (cause_type) {
-        case 1: // S模式软件中断 (由M模式时钟中断触发)
-            timer_interrupt_handler();
+        case 1: // S模式软件中断 (由M模式时钟中断或其他CPU的IPI触发)
+            tick = soft_interrupt_handler();
             break;
         case 9: // S模式外部中断 (PLIC)
             external_interrupt_handler();
@@ -69,8 +96,22 @@ void trap_user_handler()
         case 13: // Load Page Fault
         case 15: // Store/AMO Page Fault
         {
-            // 处理用户栈的自动增长
             uint64 bad_addr = r_stval();
+
+            // 内存不够时先换出一些页面, 后面的处理才有页面可用
+            intr_on();
+            swap_balance();
+            intr_off();
+
+            // 写入写时复制页面
+            if (cause_type == 15 && cow_fault(curr_proc, bad_addr) == 0)
+                break;
+
+            // 第一次访问堆或 mmap 区域的页面
+            if (lazy_fault(curr_proc, bad_addr, cause_type == 15) == 0)
+                break;
+
+            // 处理用户栈的自动增长
             // printf("User Page Fault: addr=%p, type=%d\n", bad_addr, cause_type);
             
             uint64 current_stack_pages = curr_proc->ustack_npage;
@@ -79,28 +120,46 @@ void trap_user_handler()
             
             if (new_stack_pages == (uint64)-1) {
                 printf("Stack overflow or invalid access: pid=%d, addr=%p\n", curr_proc->pid, bad_addr);
-                curr_proc->state = ZOMBIE; // 杀死进程
-                curr_proc->exit_code = -1;
-                proc_sched();
+                kill_current(); // 杀死进程
             } else {
                 curr_proc->ustack_npage = new_stack_pages;
             }
             break;
         }
+        case 12: // Instruction Page Fault
+            // 第一次执行 mmap 区域中的代码, 其余情况按无法处理的异常终止进程
+            intr_on();
+            swap_balance();
+            intr_off();
+            if (lazy_fault(curr_proc, r_stval(), false) == 0)
+                break;
+            // fall through
         default:
             printf("Unhandled user exception: id=%d, pid=%d\n", cause_type, curr_proc->pid);
             printf("sepc=%p stval=%p\n", frame->user_to_kern_epc, r_stval());
-            curr_proc->state = ZOMBIE; // 无法处理的异常，终止进程
-            curr_proc->exit_code = -1;
-            proc_sched();
+            kill_current(); // 无法处理的异常，终止进程
             break;
         }
     }
 
     // 4. 检查是否需要调度
     // 如果是时钟中断，说明时间片用完，强制让出 CPU
-    if (is_interrupt && cause_type == 1) {
+    // 让出之前顺便尝试把当前进程的4KB页面合并成透明大页, 合并内容相同的页面, 以及估计工作集
+    // 这些扫描要复制/比较整页(合并大页时是2MB)的数据, 和缺页处理一样打开中断进行,
+    // 并且相互错开, 同一个节拍最多做其中一种
+    if (tick) {
+        uint64 ticks = timer_get_ticks();
+        intr_on();
+        if (ticks % THP_SCAN_TICKS == 0)
+            uvm_thp_scan();
+        else if (ticks % KSM_SCAN_TICKS == KSM_SCAN_TICKS / 3)
+            ksm_scan();
+        else if (ticks % WSS_SCAN_TICKS == WSS_SCAN_TICKS * 2 / 3)
+            wss_scan();
+        intr_off();
+        curr_proc->user_preempted = true;
         proc_yield();
+        curr_proc->user_preempted = false;
     }
 
     // 5. 返回用户态
@@ -131,8 +190,10 @@ void trap_user_return()
     // 4. 设置 sstatus 寄存器
     // 清除 SPP (Previous Mode = User)
     // 设置 SPIE (Previous Interrupt Enable = 1)，以便返回用户态后开启中断
+    // 清除 VS: 向量寄存器不属于进程上下文, 用户态不能使用 (内核用过的内容也不能被看到)
     uint64 sstatus_val = r_sstatus();
     sstatus_val &= ~SSTATUS_SPP; 
+    sstatus_val &= ~SSTATUS_VS;
     sstatus_val |= SSTATUS_SPIE;
     w_sstatus(sstatus_val);
 
@@ -140,15 +201,18 @@ void trap_user_return()
     w_sepc(frame->user_to_kern_epc);
 
     // 6. 准备页表
-    // 生成写入 satp 寄存器的值
-    uint64 satp_val = MAKE_SATP(curr_proc->pgtbl);
+    // 生成写入 satp 寄存器的值 (带上进程的ASID)
+    bool flush;
+    uint64 satp_val = uvm_activate(curr_proc, &flush);
+    frame->user_to_kern_flush = flush;
 
     // 7. 跳转到 trampoline 中的 user_return
-    // 函数原型: void user_return(uint64 trapframe_va, uint64 satp_val);
+    // 函数原型: void user_return(uint64 trapframe_va, uint64 satp_val, uint64 flush);
     uint64 trampoline_userret = TRAMPOLINE + ((uint64)user_return - (uint64)trampoline);
     
     // 使用函数指针进行跳转
     // 参数 a0: TRAPFRAME (trapframe 在用户页表中的虚拟地址)
     // 参数 a1: satp 值 (即将切换的用户页表)
-    ((void (*)(uint64, uint64))trampoline_userret)(TRAPFRAME, satp_val);
+    // 参数 a2: 切换页表后是否需要刷新整个TLB
+    ((void (*)(uint64, uint64, uint64))trampoline_userret)(TRAPFRAME, satp_val, flush);
 }
\ No newline at end of file
@@ -153,9 +153,11 @@ int main(int argc, char* argv[])
 	sb.data_bitmap_blocks = COUNT_BLOCKS(N_DATA_BLOCK, BIT_PER_BLOCK);
 	sb.data_firstblock = sb.data_bitmap_firstblock + sb.data_bitmap_blocks;
 	sb.data_blocks = N_DATA_BLOCK;
+	sb.swap_firstblock = sb.data_firstblock + sb.data_blocks;
+	sb.swap_blocks = N_SWAP_BLOCK;
     sb.total_inodes = N_INODE;
 	sb.total_blocks = 1 + sb.inode_bitmap_blocks + sb.inode_blocks
-			+ sb.data_bitmap_blocks + sb.data_blocks;
+			+ sb.data_bitmap_blocks + sb.data_blocks + sb.swap_blocks;
 
     /* step-2: 创建磁盘文件 */
     disk_fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0666);
@@ -241,6 +243,8 @@ int main(int argc, char* argv[])
     sb.data_bitmap_firstblock = xint(sb.data_bitmap_firstblock);
     sb.data_blocks = xint(sb.data_blocks);
     sb.data_firstblock = xint(sb.data_firstblock);
+    sb.swap_firstblock = xint(sb.swap_firstblock);
+    sb.swap_blocks = xint(sb.swap_blocks);
     sb.total_inodes = xint(sb.total_inodes);
     sb.total_blocks = xint(sb.total_blocks);
     memcpy(data_buf, &sb, sizeof(sb));
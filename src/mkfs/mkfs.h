@@ -32,6 +32,8 @@ typedef struct super_block {
 	unsigned int data_bitmap_blocks;         // data_bitmap区域的块数量
 	unsigned int data_firstblock;            // data区域的起始块号
     unsigned int data_blocks;                // data区域的块数量
+    unsigned int swap_firstblock;            // 交换区的起始块号 (紧跟在data区域之后)
+    unsigned int swap_blocks;                // 交换区的块数量 (0表示没有交换区)
 } super_block_t;
 
 
@@ -96,6 +98,7 @@ typedef struct dentry {
 #define BLOCK_SIZE       4096                 // 块的大小与页面大小保持一致
 #define N_DATA_BLOCK     (32 * 1024)      // 数据区域设为 5GB
 #define N_INODE          (1 << 16)            // 文件数量上限设为 65536个
+#define N_SWAP_BLOCK     (16 * 1024)          // 交换区设为 64MB (每块存放一个换出的页面)
 #define ROOT_INODE_NUM   0                    // 根目录的inode序号
 
 // 辅助计算
@@ -0,0 +1,50 @@
+// bench: 进程切换(ping-pong)的开销, 对比开启/关闭ASID
+// 用法: 将本文件复制为 src/user/initcode.c 后以 CPUNUM=1 make run
+// 父子进程轮流访问各自的 NPAGES 个堆页面后让出CPU
+// 关闭ASID时每次切换页表都会刷新整个TLB, 开启后各自的TLB表项可以保留
+// 注意: QEMU 的 TLB 模型不区分ASID, 差距主要体现在真实硬件上
+#include "sys.h"
+
+#define NPAGES 32
+#define ROUNDS 2000
+#define PGSIZE 4096
+
+static long pingpong(char *heap)
+{
+	long start = syscall(SYS_uptime);
+
+	int pid = syscall(SYS_fork);
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < NPAGES; i++)
+			heap[i * PGSIZE]++;
+		syscall(SYS_yield);
+	}
+	if (pid == 0)
+		syscall(SYS_exit, 0);
+	syscall(SYS_wait, 0);
+
+	return syscall(SYS_uptime) - start;
+}
+
+static void report(char *name, long cycles)
+{
+	syscall(SYS_print_str, "asid_pingpong: ");
+	syscall(SYS_print_str, name);
+	syscall(SYS_print_str, " cycles/round ");
+	syscall(SYS_print_int, (int)(cycles / ROUNDS));
+	syscall(SYS_print_str, "\n");
+}
+
+int main()
+{
+	long top = syscall(SYS_brk, 0);
+	char *heap = (char *)syscall(SYS_brk, top + NPAGES * PGSIZE) - NPAGES * PGSIZE;
+
+	syscall(SYS_asid_ctl, 0);
+	report("no-asid", pingpong(heap));
+
+	syscall(SYS_asid_ctl, 1);
+	report("asid", pingpong(heap));
+
+	while(1);
+}
@@ -0,0 +1,34 @@
+// bench: 物理页分配器的多核扩展性
+// 用法: 将本文件复制为 src/user/initcode.c 后 make run
+// 分别以 CPUNUM=1/2/4 (即 qemu -smp) 运行, 并让 NWORKER 与 CPUNUM 保持一致
+// 每个 worker 输出自己完成 ROUNDS 轮测试消耗的千周期数, 数值越稳定说明扩展性越好
+#include "sys.h"
+
+#define NWORKER 2
+#define ROUNDS  4000
+
+int main()
+{
+	int worker = 0;
+	for (int i = 1; i < NWORKER; i++) {
+		if (syscall(SYS_fork) == 0) {
+			worker = i;
+			break;
+		}
+	}
+
+	long cycles = syscall(SYS_pmem_bench, ROUNDS, 0);
+
+	syscall(SYS_print_str, "pmem_bench: worker ");
+	syscall(SYS_print_int, worker);
+	syscall(SYS_print_str, " kcycles ");
+	syscall(SYS_print_int, (int)(cycles / 1000));
+	syscall(SYS_print_str, "\n");
+
+	if (worker != 0)
+		syscall(SYS_exit, 0);
+	for (int i = 1; i < NWORKER; i++)
+		syscall(SYS_wait, 0);
+
+	while(1);
+}
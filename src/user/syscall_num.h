@@ -34,4 +34,17 @@
 #define SYS_print_cwd 32
 #define SYS_link 33
 #define SYS_unlink 34
-#define SYS_exec 35
\ No newline at end of file
+#define SYS_exec 35
+
+// 性能测试
+#define SYS_pmem_bench 36
+#define SYS_show_pmem 37
+#define SYS_show_kmem 38
+#define SYS_yield 39
+#define SYS_uptime 40
+#define SYS_asid_ctl 41
+#define SYS_msync 42
+#define SYS_mem_bench 43
+#define SYS_show_tlb 44
+#define SYS_madvise 45
+#define SYS_show_wss 46
\ No newline at end of file
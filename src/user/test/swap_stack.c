@@ -0,0 +1,60 @@
+// test: 换出增长出来的用户栈页面之后再访问它
+// 用法: 将本文件复制为 src/user/initcode.c 后 make run, 期望输出 "swap_stack: ok"
+// 先让用户栈增长 STACK_PAGES 个页面并写入内容, 再不断写一个比用户池还大的堆逼迫换出,
+// 最后检查栈上的内容 (缺页必须把栈页面从交换区读回来, 否则会一直缺页或者被杀死)
+#include "sys.h"
+
+#define PGSIZE 4096
+#define STACK_PAGES 16
+#define HEAP_PAGES (32 * 1024)  // 128MB, 超过默认的用户池
+#define ROUNDS 3
+
+static void fail(char *what, int i)
+{
+	syscall(SYS_print_str, "swap_stack: FAIL ");
+	syscall(SYS_print_str, what);
+	syscall(SYS_print_str, " ");
+	syscall(SYS_print_int, i);
+	syscall(SYS_print_str, "\n");
+	while(1);
+}
+
+static void pressure(char *heap, int round)
+{
+	for (int i = 0; i < HEAP_PAGES; i++)
+		heap[(long)i * PGSIZE] = (char)(i + round);
+}
+
+static void test(char *heap)
+{
+	volatile char buf[STACK_PAGES * PGSIZE];
+
+	for (int i = 0; i < STACK_PAGES; i++)
+		buf[i * PGSIZE] = (char)(0x5a + i);
+	buf[1] = '\0'; // buf[0]开始是一个字符串 "Z"
+
+	for (int r = 0; r < ROUNDS; r++)
+		pressure(heap, r);
+	syscall(SYS_show_pmem);
+
+	// 用户态访问 (缺页换入)
+	for (int i = 0; i < STACK_PAGES; i++) {
+		if (buf[i * PGSIZE] != (char)(0x5a + i))
+			fail("stack page", i);
+	}
+
+	// 再换出一次, 这次由内核拷贝(uvm_copyout/uvm_copyin)访问栈页面
+	pressure(heap, ROUNDS);
+	if (syscall(SYS_print_str, (char *)&buf[0]) < 0)
+		fail("copyin", 0);
+}
+
+int main()
+{
+	long top = syscall(SYS_brk, 0);
+	char *heap = (char *)syscall(SYS_brk, top + (long)HEAP_PAGES * PGSIZE) - (long)HEAP_PAGES * PGSIZE;
+
+	test(heap);
+	syscall(SYS_print_str, "\nswap_stack: ok\n");
+	while(1);
+}